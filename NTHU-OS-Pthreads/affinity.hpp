@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "numa.hpp"
+
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+enum AffinityPolicy {
+	// threads float, the scheduler places them
+	AFFINITY_NONE,
+	// every thread gets the next cpu in pipeline order (reader, each
+	// stage, writer), so neighbouring stages share a node when they fit
+	AFFINITY_COMPACT,
+	// the reader and writer get a cpu each, then the i-th thread of every
+	// stage shares the i-th of the remaining cpus, so a producer runs next
+	// to the consumer most likely to take its items
+	AFFINITY_PAIRED
+};
+
+// "none", "compact" or "paired", false for any other name
+inline bool parse_affinity_policy(const std::string& name, AffinityPolicy& policy) {
+	if (name == "none")
+		policy = AFFINITY_NONE;
+	else if (name == "compact")
+		policy = AFFINITY_COMPACT;
+	else if (name == "paired")
+		policy = AFFINITY_PAIRED;
+	else
+		return false;
+	return true;
+}
+
+// pins a started thread to cpus[index % size], nothing if cpus is empty
+inline void pin_thread(Thread* thread, const std::vector<int>& cpus, int index) {
+	if (cpus.empty())
+		return;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpus[index % cpus.size()], &set);
+	thread->set_affinity(set);
+}
+
+// cpus AFFINITY_PAIRED keeps for the reader and the writer
+#define AFFINITY_SINGLE_CPUS 2
+
+// Hands out cpus to the stages in pipeline order and places the slot
+// buffer of each queue on the memory node of the stage that drains it, so
+// the elements it reads stay on its socket.
+class AffinityPlan {
+public:
+	explicit AffinityPlan(AffinityPolicy policy);
+
+	// the cpus for the next transform stage's threads (a scaling stage
+	// asks for its maximum), empty when threads float
+	std::vector<int> assign(int threads);
+
+	// the cpu of the reader or the writer, which never shares its cpu
+	// with a transform thread while there are enough cpus
+	std::vector<int> assign_single();
+
+	// moves the queue's buffer to the node of its first consumer cpu,
+	// before any thread uses the queue
+	void place(Queue<Item*>* queue, const std::vector<int>& consumer_cpus);
+private:
+	AffinityPolicy policy;
+	CpuTopology topology;
+	// the next cpu of AFFINITY_COMPACT and of assign_single under
+	// AFFINITY_PAIRED, an index into topology.get_cpus()
+	size_t next;
+};
+
+// Implementation start
+
+AffinityPlan::AffinityPlan(AffinityPolicy policy) : policy(policy) {
+	next = 0;
+}
+
+std::vector<int> AffinityPlan::assign(int threads) {
+	std::vector<int> ret;
+	const std::vector<int>& cpus = topology.get_cpus();
+	if (policy == AFFINITY_NONE || cpus.empty())
+		return ret;
+
+	// the stages pair up on the cpus after the reader's and the writer's,
+	// or on all of them when there are too few to keep those apart
+	size_t first = 0;
+	if (policy == AFFINITY_PAIRED && cpus.size() > AFFINITY_SINGLE_CPUS)
+		first = AFFINITY_SINGLE_CPUS;
+	size_t pairs = cpus.size() - first;
+
+	// more threads than cpus share them round-robin
+	int n = threads < (int)pairs ? threads : pairs;
+	for (int i = 0; i < n; i++) {
+		if (policy == AFFINITY_COMPACT)
+			ret.push_back(cpus[next++ % cpus.size()]);
+		else
+			ret.push_back(cpus[first + i]);
+	}
+	return ret;
+}
+
+std::vector<int> AffinityPlan::assign_single() {
+	std::vector<int> ret;
+	const std::vector<int>& cpus = topology.get_cpus();
+	if (policy == AFFINITY_NONE || cpus.empty())
+		return ret;
+
+	if (policy == AFFINITY_PAIRED)
+		ret.push_back(cpus[next++ % AFFINITY_SINGLE_CPUS % cpus.size()]);
+	else
+		ret.push_back(cpus[next++ % cpus.size()]);
+	return ret;
+}
+
+void AffinityPlan::place(Queue<Item*>* queue, const std::vector<int>& consumer_cpus) {
+	if (consumer_cpus.empty())
+		return;
+	queue->place_on_node(topology.node_of(consumer_cpus[0]));
+}
+
+#endif // AFFINITY_HPP
@@ -0,0 +1,306 @@
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <iostream>
+#include "item.hpp"
+
+#ifndef BUFFERED_OUTPUT_HPP
+#define BUFFERED_OUTPUT_HPP
+
+#define BUFFERED_OUTPUT_SIZE (1 << 20)
+// O_DIRECT needs buffers, offsets and lengths aligned to the block size
+#define BUFFERED_OUTPUT_ALIGNMENT 4096
+
+// Formats items straight into a large buffer and hands the whole buffer to
+// a single write(). With async set, two buffers alternate and a flusher
+// thread writes one while the Writer fills the other. With direct set the
+// file is opened with O_DIRECT (falling back to buffered I/O if the file
+// system refuses it) and the last partial block is padded, then truncated.
+class BufferedOutput {
+public:
+	// constructor
+	BufferedOutput(std::string output_file, bool async = false, bool direct = false, int buffer_size = BUFFERED_OUTPUT_SIZE);
+
+	// destructor, flushes whatever is left and closes the file
+	~BufferedOutput();
+
+	// append "key val opcode\n", the same text as operator<<
+	void write_item(const Item& item);
+
+	// write everything buffered so far
+	void flush();
+private:
+	int fd;
+	bool async;
+	bool direct;
+	int buffer_size;
+
+	// the buffer being filled and its length
+	char* buffer;
+	int length;
+
+	// bytes already in the file
+	off_t written;
+
+	// async mode: the buffer owned by the flusher thread
+	char* spare;
+	int spare_length;
+	bool spare_busy;
+	bool stopping;
+	pthread_t flusher;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_busy, cond_idle;
+
+	char* allocate();
+
+	// writes len bytes synchronously, retrying short writes
+	void write_all(const char* data, int len);
+
+	// hands the full part of the current buffer to the disk
+	void submit(bool final);
+
+	static void* flush_loop(void* arg);
+};
+
+// Implementation start
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// writes the decimal digits of val at out, two at a time, returns the end
+static inline char* format_u64(char* out, unsigned long long val) {
+	char tmp[20];
+	char* p = tmp + 20;
+
+	while (val >= 100) {
+		int i = (int)(val % 100) * 2;
+		val /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+	if (val >= 10) {
+		int i = (int)val * 2;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	} else {
+		*--p = (char)('0' + val);
+	}
+
+	int len = tmp + 20 - p;
+	memcpy(out, p, len);
+	return out + len;
+}
+
+BufferedOutput::BufferedOutput(std::string output_file, bool async, bool direct, int buffer_size)
+	: async(async), direct(direct), buffer_size(buffer_size) {
+	// keep the buffer a whole number of blocks, at least two so a
+	// nearly full buffer always has a whole block to write
+	if (this->buffer_size < 2 * BUFFERED_OUTPUT_ALIGNMENT)
+		this->buffer_size = 2 * BUFFERED_OUTPUT_ALIGNMENT;
+	this->buffer_size -= this->buffer_size % BUFFERED_OUTPUT_ALIGNMENT;
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	fd = -1;
+	if (direct)
+		fd = open(output_file.c_str(), flags | O_DIRECT, 0644);
+	if (fd < 0) {
+		this->direct = false;
+		fd = open(output_file.c_str(), flags, 0644);
+	}
+	if (fd < 0)
+		std::cerr << "cannot open " << output_file << ": " << strerror(errno) << std::endl;
+
+	buffer = allocate();
+	length = 0;
+	written = 0;
+
+	spare = nullptr;
+	spare_length = 0;
+	spare_busy = false;
+	stopping = false;
+
+	if (async) {
+		spare = allocate();
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond_busy, NULL);
+		pthread_cond_init(&cond_idle, NULL);
+		pthread_create(&flusher, 0, BufferedOutput::flush_loop, (void*)this);
+	}
+}
+
+BufferedOutput::~BufferedOutput() {
+	flush();
+
+	if (async) {
+		pthread_mutex_lock(&mutex);
+		stopping = true;
+		pthread_cond_signal(&cond_busy);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(flusher, 0);
+
+		pthread_mutex_destroy(&mutex);
+		pthread_cond_destroy(&cond_busy);
+		pthread_cond_destroy(&cond_idle);
+		free(spare);
+	}
+
+	free(buffer);
+	if (fd >= 0)
+		close(fd);
+}
+
+char* BufferedOutput::allocate() {
+	void* p = nullptr;
+	if (posix_memalign(&p, BUFFERED_OUTPUT_ALIGNMENT, buffer_size) != 0)
+		p = nullptr;
+	return (char*)p;
+}
+
+void BufferedOutput::write_item(const Item& item) {
+	// the longest line: 11 (int) + 1 + 20 (u64) + 1 + 1 + 1
+	if (buffer_size - length < 40)
+		submit(false);
+
+	char* p = buffer + length;
+
+	unsigned long long key = item.key;
+	if (item.key < 0) {
+		*p++ = '-';
+		key = -(long long)item.key;
+	}
+	p = format_u64(p, key);
+	*p++ = ' ';
+	p = format_u64(p, item.val);
+	*p++ = ' ';
+	*p++ = item.opcode;
+	*p++ = '\n';
+
+	length = p - buffer;
+}
+
+void BufferedOutput::flush() {
+	submit(true);
+
+	if (async) {
+		// wait for the flusher to finish the last buffer
+		pthread_mutex_lock(&mutex);
+		while (spare_busy)
+			pthread_cond_wait(&cond_idle, &mutex);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+void BufferedOutput::write_all(const char* data, int len) {
+	while (len > 0 && fd >= 0) {
+		ssize_t ret = pwrite(fd, data, len, written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			std::cerr << "write failed: " << strerror(errno) << std::endl;
+			return;
+		}
+		data += ret;
+		len -= ret;
+		written += ret;
+	}
+}
+
+void BufferedOutput::submit(bool final) {
+	int len = length;
+
+	// O_DIRECT writes whole blocks only, keep the tail for later
+	// unless this is the last write, which is padded and truncated
+	int pad = 0;
+	if (direct) {
+		int tail = len % BUFFERED_OUTPUT_ALIGNMENT;
+		if (!final)
+			len -= tail;
+		else if (tail > 0)
+			pad = BUFFERED_OUTPUT_ALIGNMENT - tail;
+	}
+
+	if (len == 0)
+		return;
+
+	if (!async) {
+		memset(buffer + len, 0, pad);
+		off_t end = written + len;
+		write_all(buffer, len + pad);
+		if (pad > 0) {
+			if (ftruncate(fd, end) != 0)
+				std::cerr << "truncate failed: " << strerror(errno) << std::endl;
+			written = end;
+		}
+	} else {
+		pthread_mutex_lock(&mutex);
+		while (spare_busy)
+			pthread_cond_wait(&cond_idle, &mutex);
+
+		// swap buffers, the flusher writes the full one
+		char* full = buffer;
+		buffer = spare;
+		spare = full;
+		memset(spare + len, 0, pad);
+		spare_length = len + pad;
+		spare_busy = true;
+		pthread_cond_signal(&cond_busy);
+		pthread_mutex_unlock(&mutex);
+
+		if (pad > 0) {
+			// the padding is cut off once the flusher is done
+			pthread_mutex_lock(&mutex);
+			while (spare_busy)
+				pthread_cond_wait(&cond_idle, &mutex);
+			pthread_mutex_unlock(&mutex);
+			written -= pad;
+			if (ftruncate(fd, written) != 0)
+				std::cerr << "truncate failed: " << strerror(errno) << std::endl;
+		}
+	}
+
+	// move the unwritten tail to the front of the current buffer
+	int rest = length - len;
+	if (rest > 0)
+		memmove(buffer, (async ? spare : buffer) + len, rest);
+	length = rest;
+}
+
+void* BufferedOutput::flush_loop(void* arg) {
+	BufferedOutput* output = (BufferedOutput*)arg;
+
+	pthread_mutex_lock(&output->mutex);
+	while (1) {
+		while (!output->spare_busy && !output->stopping)
+			pthread_cond_wait(&output->cond_busy, &output->mutex);
+		if (!output->spare_busy && output->stopping)
+			break;
+
+		char* data = output->spare;
+		int len = output->spare_length;
+		pthread_mutex_unlock(&output->mutex);
+
+		output->write_all(data, len);
+
+		pthread_mutex_lock(&output->mutex);
+		output->spare_busy = false;
+		pthread_cond_signal(&output->cond_idle);
+	}
+	pthread_mutex_unlock(&output->mutex);
+
+	return nullptr;
+}
+
+#endif // BUFFERED_OUTPUT_HPP
@@ -0,0 +1,151 @@
+#include <atomic>
+#include <vector>
+
+#ifndef CHASE_LEV_DEQUE_HPP
+#define CHASE_LEV_DEQUE_HPP
+
+#define CHASE_LEV_DEQUE_INITIAL_CAPACITY 64
+
+// Chase-Lev work-stealing deque (the C11 formulation by Le et al.).
+// The owner thread pushes and pops at the bottom without any atomic
+// read-modify-write in the common case, other threads steal from the top.
+// T must be trivially copyable and fit in an atomic (e.g. a pointer).
+template <class T>
+class ChaseLevDeque {
+public:
+	// constructor
+	ChaseLevDeque();
+
+	// destructor
+	~ChaseLevDeque();
+
+	// owner only: add an element at the bottom, growing when full
+	void push(T item);
+
+	// owner only: take the most recently pushed element
+	bool pop(T& item);
+
+	// any thread: take the oldest element, false when empty or lost a race
+	bool steal(T& item);
+
+	// return the (approximate) number of elements in the deque
+	int get_size();
+private:
+	struct Array {
+		long capacity;
+		std::atomic<T>* buffer;
+
+		explicit Array(long capacity) : capacity(capacity) {
+			buffer = new std::atomic<T>[capacity];
+		}
+
+		~Array() {
+			delete [] buffer;
+		}
+
+		T get(long i) {
+			return buffer[i & (capacity - 1)].load(std::memory_order_relaxed);
+		}
+
+		void put(long i, T item) {
+			buffer[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+		}
+	};
+
+	std::atomic<long> top;
+	std::atomic<long> bottom;
+	std::atomic<Array*> array;
+
+	// arrays replaced by a grow, a thief may still be reading them
+	std::vector<Array*> retired;
+
+	Array* grow(Array* old, long b, long t);
+};
+
+// Implementation start
+
+template <class T>
+ChaseLevDeque<T>::ChaseLevDeque() {
+	top.store(0, std::memory_order_relaxed);
+	bottom.store(0, std::memory_order_relaxed);
+	array.store(new Array(CHASE_LEV_DEQUE_INITIAL_CAPACITY), std::memory_order_relaxed);
+}
+
+template <class T>
+ChaseLevDeque<T>::~ChaseLevDeque() {
+	delete array.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < retired.size(); i++)
+		delete retired[i];
+}
+
+template <class T>
+typename ChaseLevDeque<T>::Array* ChaseLevDeque<T>::grow(Array* old, long b, long t) {
+	Array* a = new Array(old->capacity * 2);
+	for (long i = t; i < b; i++)
+		a->put(i, old->get(i));
+
+	retired.push_back(old);
+	array.store(a, std::memory_order_release);
+	return a;
+}
+
+template <class T>
+void ChaseLevDeque<T>::push(T item) {
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_acquire);
+	Array* a = array.load(std::memory_order_relaxed);
+
+	if (b - t > a->capacity - 1)
+		a = grow(a, b, t);
+
+	a->put(b, item);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+template <class T>
+bool ChaseLevDeque<T>::pop(T& item) {
+	long b = bottom.load(std::memory_order_relaxed) - 1;
+	Array* a = array.load(std::memory_order_relaxed);
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		// empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	item = a->get(b);
+	if (t == b) {
+		// the last element, race the thieves for it
+		bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+template <class T>
+bool ChaseLevDeque<T>::steal(T& item) {
+	long t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return false;
+
+	Array* a = array.load(std::memory_order_acquire);
+	item = a->get(t);
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template <class T>
+int ChaseLevDeque<T>::get_size() {
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_relaxed);
+	return b > t ? (int)(b - t) : 0;
+}
+
+#endif // CHASE_LEV_DEQUE_HPP
@@ -1,31 +1,83 @@
 #include <pthread.h>
 #include <stdio.h>
+#include <atomic>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "transform_batch.hpp"
+#include "stats.hpp"
 
 #ifndef CONSUMER_HPP
 #define CONSUMER_HPP
 
+// how long, in microseconds, a consumer waits on an empty worker queue
+// before it looks at its stop token again
+#define CONSUMER_STOP_CHECK_PERIOD 10000
+
+// A consumer is stopped cooperatively: its stop token is checked between
+// batches, so the batch in hand is always transformed and passed on. A
+// stopped consumer parks instead of exiting, and unpark() resumes it
+// without creating a new thread.
 class Consumer : public Thread {
 public:
 	// constructor
-	Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer);
+	Consumer(Queue<Item*>* worker_queue, Queue<Item*>* output_queue, Transformer* transformer, int batch_size = 1, ThreadStats* stats = nullptr, TransformMany many = &Transformer::consumer_transform_many, TransformCache* cache = nullptr);
 
 	// destructor
 	~Consumer();
 
 	virtual void start() override;
 
+	// asks the thread to exit after its current batch, parked or not;
+	// join() it afterwards
 	virtual int cancel() override;
+
+	// asks the thread to park after its current batch, returns at once
+	void request_park();
+
+	// waits until the thread has parked (or has exited at the end of the
+	// stream)
+	void wait_parked();
+
+	// resumes a parked (or parking) thread
+	void unpark();
+
+	// whether the thread has left its loop and can be joined at once
+	bool is_finished();
 private:
-	TSQueue<Item*>* worker_queue;
-	TSQueue<Item*>* output_queue;
+	Queue<Item*>* worker_queue;
+	Queue<Item*>* output_queue;
 
 	Transformer* transformer;
 
-	bool is_cancel;
+	// the maximum number of items moved per queue operation
+	int batch_size;
+
+	// when set, queue waits and transform times are counted here
+	ThreadStats* stats;
+
+	// the transform this stage applies
+	TransformMany many;
+
+	// when set, results are looked up here before transforming
+	TransformCache* cache;
+
+	// checked between batches: park (or exit, with exiting) when set
+	std::atomic<bool> stop_token;
+
+	// guarded by mutex
+	bool parked;
+	bool exiting;
+	std::atomic<bool> finished;
+
+	pthread_mutex_t mutex;
+	// signalled on park, unpark, exit and finish
+	pthread_cond_t cond;
+
+	// transforms batches until the stop token is set, false when the
+	// worker queue is closed and drained
+	bool run(Item** batch);
 
 	// the method for pthread to create a consumer thread
 	static void* process(void* arg);
@@ -33,12 +85,20 @@ private:
 
 };
 
-Consumer::Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer)
-	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer) {
-	is_cancel = false;
+Consumer::Consumer(Queue<Item*>* worker_queue, Queue<Item*>* output_queue, Transformer* transformer, int batch_size, ThreadStats* stats, TransformMany many, TransformCache* cache)
+	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer), batch_size(batch_size), stats(stats), many(many), cache(cache) {
+	stop_token.store(false);
+	parked = false;
+	exiting = false;
+	finished.store(false);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
 }
 
-Consumer::~Consumer() {}
+Consumer::~Consumer() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond);
+}
 
 void Consumer::start() {
 	// TODO: starts a Consumer thread
@@ -47,34 +107,92 @@ void Consumer::start() {
 
 int Consumer::cancel() {
 	// TODO: cancels the consumer thread
-	is_cancel = true;
-	return pthread_cancel(t);
+	pthread_mutex_lock(&mutex);
+	exiting = true;
+	stop_token.store(true, std::memory_order_release);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	return 0;
 }
 
-void* Consumer::process(void* arg) {
-	Consumer* consumer = (Consumer*)arg;
+void Consumer::request_park() {
+	stop_token.store(true, std::memory_order_release);
+}
 
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, nullptr);
+void Consumer::wait_parked() {
+	pthread_mutex_lock(&mutex);
+	while (!parked && !finished.load(std::memory_order_relaxed))
+		pthread_cond_wait(&cond, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
 
-	while (!consumer->is_cancel) {
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+void Consumer::unpark() {
+	pthread_mutex_lock(&mutex);
+	stop_token.store(false, std::memory_order_release);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+}
 
+bool Consumer::is_finished() {
+	return finished.load(std::memory_order_acquire);
+}
+
+bool Consumer::run(Item** batch) {
+	while (!stop_token.load(std::memory_order_acquire)) {
 		// TODO: implements the Consumer's work
-		//if(consumer->worker_queue->get_size() > 0)
-		//{
-			Item* item;
-			item = consumer->worker_queue->dequeue();
+		unsigned long long start = stats ? stats_now_ns() : 0;
+		int count = worker_queue->dequeue_bulk_timed(batch, batch_size, CONSUMER_STOP_CHECK_PERIOD);
+		if (stats)
+			ThreadStats::add(stats->input_wait_ns, stats_now_ns() - start);
+
+		if (count == 0) {
+			// the worker queue is closed and drained, the stream is over
+			if (worker_queue->is_closed() && worker_queue->get_size() == 0)
+				return false;
+			// else timed out, look at the stop token again
+			continue;
+		}
+
+		transform_batch(transformer, many, batch, count, stats, cache);
+
+		if (stats)
+			start = stats_now_ns();
+		output_queue->enqueue_bulk(batch, count);
+		if (stats)
+			ThreadStats::add(stats->output_wait_ns, stats_now_ns() - start);
+	}
 
+	return true;
+}
+
+void* Consumer::process(void* arg) {
+	Consumer* consumer = (Consumer*)arg;
 
-			item->val = consumer->transformer->consumer_transform(item->opcode, item->val);
+	Item** batch = new Item*[consumer->batch_size];
 
+	while (consumer->run(batch)) {
+		pthread_mutex_lock(&consumer->mutex);
 
-			consumer->output_queue->enqueue(item);			
-		//}
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+		consumer->parked = true;
+		pthread_cond_broadcast(&consumer->cond);
+		while (consumer->stop_token.load(std::memory_order_relaxed) && !consumer->exiting)
+			pthread_cond_wait(&consumer->cond, &consumer->mutex);
+		consumer->parked = false;
+
+		bool exiting = consumer->exiting;
+		pthread_mutex_unlock(&consumer->mutex);
+
+		if (exiting)
+			break;
 	}
 
-	delete consumer;
+	delete [] batch;
+
+	// the controller joins and deletes it
+	pthread_mutex_lock(&consumer->mutex);
+	consumer->finished.store(true, std::memory_order_release);
+	pthread_cond_broadcast(&consumer->cond);
+	pthread_mutex_unlock(&consumer->mutex);
 
 	return nullptr;
 }
@@ -1,25 +1,39 @@
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 #include <vector>
 #include <iostream>
 #include "consumer.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "scaling_policy.hpp"
+#include "stats.hpp"
+#include "affinity.hpp"
 
 #ifndef CONSUMER_CONTROLLER
 #define CONSUMER_CONTROLLER
 
+// how often, in microseconds, a sleeping controller checks for the end of
+// the stream, so shutting down does not wait for a whole check period
+#define CONSUMER_CONTROLLER_POLL_PERIOD 10000
+
 class ConsumerController : public Thread {
 public:
 	// constructor
 	ConsumerController(
-		TSQueue<Item*>* worker_queue,
-		TSQueue<Item*>* writer_queue,
+		Queue<Item*>* worker_queue,
+		Queue<Item*>* writer_queue,
 		Transformer* transformer,
 		int check_period,
 		int low_threshold,
-		int high_threshold
+		int high_threshold,
+		int batch_size = 1,
+		ScalingPolicy* policy = nullptr,
+		StatsRegistry* stats = nullptr,
+		TransformMany many = &Transformer::consumer_transform_many,
+		std::string stage_name = "consumer",
+		TransformCache* cache = nullptr
 	);
 
 	// destructor
@@ -27,12 +41,20 @@ public:
 
 	virtual void start();
 
+	// before start(): the i-th consumer is pinned to cpus[i % size]
+	void set_cpus(const std::vector<int>& cpus);
+
+	// The controller returns once the worker queue is closed and drained
+	// and every consumer it started has been joined, so the caller may
+	// then close the writer queue.
 
 private:
 	std::vector<Consumer*> consumers;
+	// scaled-down consumers, their threads parked until the next scale-up
+	std::vector<Consumer*> parked;
 
-	TSQueue<Item*>* worker_queue;
-	TSQueue<Item*>* writer_queue;
+	Queue<Item*>* worker_queue;
+	Queue<Item*>* writer_queue;
 
 	Transformer* transformer;
 
@@ -44,29 +66,70 @@ private:
 	// When the number of items in the worker queue is higher than high_threshold,
 	// the number of consumers scaled up by 1.
 	int high_threshold;
+	// The batch size given to every consumer it creates.
+	int batch_size;
+	// Decides the number of consumers after every check period. Defaults to
+	// the low/high threshold rule above; the controller owns it.
+	ScalingPolicy* policy;
+	// when set, every consumer gets its own ThreadStats from it
+	StatsRegistry* stats;
+	// the transform its consumers apply, and their name in the stats
+	TransformMany many;
+	std::string stage_name;
+	// shared by its consumers, nullptr when results are not cached
+	TransformCache* cache;
+	// empty when the consumers float
+	std::vector<int> cpus;
 
 	static void* process(void* arg);
 
+	// whether the stream has ended and nothing is left to consume
+	bool is_drained();
+
 };
 
 // Implementation start
 
 ConsumerController::ConsumerController(
-	TSQueue<Item*>* worker_queue,
-	TSQueue<Item*>* writer_queue,
+	Queue<Item*>* worker_queue,
+	Queue<Item*>* writer_queue,
 	Transformer* transformer,
 	int check_period,
 	int low_threshold,
-	int high_threshold
+	int high_threshold,
+	int batch_size,
+	ScalingPolicy* policy,
+	StatsRegistry* stats,
+	TransformMany many,
+	std::string stage_name,
+	TransformCache* cache
 ) : worker_queue(worker_queue),
 	writer_queue(writer_queue),
 	transformer(transformer),
 	check_period(check_period),
 	low_threshold(low_threshold),
-	high_threshold(high_threshold) {
+	high_threshold(high_threshold),
+	batch_size(batch_size),
+	policy(policy),
+	stats(stats),
+	many(many),
+	stage_name(stage_name),
+	cache(cache) {
+	if (this->policy == nullptr)
+		this->policy = new ThresholdScalingPolicy(low_threshold, high_threshold);
 }
 
-ConsumerController::~ConsumerController() {}
+bool ConsumerController::is_drained() {
+	return worker_queue->is_closed() && worker_queue->get_size() == 0;
+}
+
+ConsumerController::~ConsumerController() {
+	delete policy;
+}
+
+void ConsumerController::set_cpus(const std::vector<int>& cpus) {
+	this->cpus = cpus;
+}
 
 void ConsumerController::start() {
 	// TODO: starts a ConsumerController thread
@@ -79,39 +142,117 @@ void* ConsumerController::process(void* arg) {
 
 	int consumer_ptr = 0;//要放consumer的下一個位置
 
+	Queue<Item*>* worker_queue = consumercontroller->worker_queue;
+	Queue<Item*>* writer_queue = consumercontroller->writer_queue;
+
+	unsigned long long last_enqueued = worker_queue->get_enqueue_count();
+	unsigned long long last_dequeued = worker_queue->get_dequeue_count();
+	struct timespec last_time;
+	clock_gettime(CLOCK_MONOTONIC, &last_time);
 
-	while(1)
+	while(!consumercontroller->is_drained())
 	{
-		
-		usleep(consumercontroller->check_period);
+		// sleep one check period, waking early once the stream ends
+		int slept = 0;
+		while (slept < consumercontroller->check_period && !consumercontroller->is_drained()) {
+			int step = consumercontroller->check_period - slept;
+			if (step > CONSUMER_CONTROLLER_POLL_PERIOD)
+				step = CONSUMER_CONTROLLER_POLL_PERIOD;
+			usleep(step);
+			slept += step;
+		}
+		if (consumercontroller->is_drained())
+			break;
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		unsigned long long enqueued = worker_queue->get_enqueue_count();
+		unsigned long long dequeued = worker_queue->get_dequeue_count();
 
-		if(consumercontroller->worker_queue->get_size() > consumercontroller->high_threshold)
+		ScalingSample sample;
+		sample.num_consumers = consumer_ptr;
+		sample.worker_queue_size = worker_queue->get_size();
+		sample.worker_queue_capacity = worker_queue->get_buffer_size();
+		sample.output_queue_size = writer_queue->get_size();
+		sample.output_queue_capacity = writer_queue->get_buffer_size();
+		sample.period = (now.tv_sec - last_time.tv_sec) + (now.tv_nsec - last_time.tv_nsec) / 1e9;
+		sample.arrival_rate = sample.period > 0 ? (enqueued - last_enqueued) / sample.period : 0;
+		sample.service_rate = sample.period > 0 ? (dequeued - last_dequeued) / sample.period : 0;
+
+		last_enqueued = enqueued;
+		last_dequeued = dequeued;
+		last_time = now;
+
+		int desired = consumercontroller->policy->decide(sample);
+
+		if(desired > consumer_ptr)
 		{
-			Consumer* consumer_temp = new Consumer(consumercontroller->worker_queue, consumercontroller->writer_queue, consumercontroller->transformer);
-		
-			if(consumercontroller->consumers.size() == consumer_ptr )
-				consumercontroller->consumers.push_back(consumer_temp);
-			
-			else 
-				consumercontroller->consumers[consumer_ptr] = consumer_temp;
-
-			consumercontroller->consumers[consumer_ptr]->start();
-
-			std::cout << "Scaling up consumers from " << consumer_ptr << " to " << consumer_ptr+1 << std::endl;
-			consumer_ptr++;
+			std::cout << "Scaling up consumers from " << consumer_ptr << " to " << desired << std::endl;
+
+			while(consumer_ptr < desired)
+			{
+				// a parked thread resumes at once, only create one if there is none
+				Consumer* consumer_temp = nullptr;
+				bool was_parked = !consumercontroller->parked.empty();
+				if (was_parked) {
+					consumer_temp = consumercontroller->parked.back();
+					consumercontroller->parked.pop_back();
+				} else {
+					ThreadStats* consumer_stats = nullptr;
+					if (consumercontroller->stats)
+						consumer_stats = consumercontroller->stats->register_thread(consumercontroller->stage_name);
+
+					consumer_temp = new Consumer(worker_queue, writer_queue, consumercontroller->transformer, consumercontroller->batch_size, consumer_stats, consumercontroller->many, consumercontroller->cache);
+				}
+
+				if(consumercontroller->consumers.size() == consumer_ptr )
+					consumercontroller->consumers.push_back(consumer_temp);
+
+				else 
+					consumercontroller->consumers[consumer_ptr] = consumer_temp;
+
+				if (was_parked)
+					consumer_temp->unpark();
+				else
+					consumer_temp->start();
+				// an unparked thread may take a different slot, so pin it again
+				pin_thread(consumer_temp, consumercontroller->cpus, consumer_ptr);
+				consumer_ptr++;
+			}
 		}
 
-		else if(consumercontroller->worker_queue->get_size() < consumercontroller->low_threshold and consumer_ptr >= 2)
+		else if(desired < consumer_ptr)
 		{
-			consumercontroller->consumers[consumer_ptr-1]->cancel();
+			std::cout << "Scaling down consumers from " << consumer_ptr << " to " << desired << std::endl;
 
-			std::cout << "Scaling down consumers from " << consumer_ptr << " to " << consumer_ptr-1 << std::endl;				
+			// let all of them finish their batch at once, then wait for each
+			for (int i = desired; i < consumer_ptr; i++)
+				consumercontroller->consumers[i]->request_park();
 
-			consumer_ptr--;
+			while(consumer_ptr > desired)
+			{
+				consumercontroller->consumers[consumer_ptr-1]->wait_parked();
+				consumercontroller->parked.push_back(consumercontroller->consumers[consumer_ptr-1]);
+				consumer_ptr--;
+			}
 		}
 	
 	}
 
+	// the worker queue is drained, so whatever a running consumer holds is
+	// its last batch; every thread, running or parked, exits after it
+	for (int i = 0; i < consumer_ptr; i++)
+		consumercontroller->parked.push_back(consumercontroller->consumers[i]);
+	consumercontroller->consumers.clear();
+
+	for (size_t i = 0; i < consumercontroller->parked.size(); i++)
+		consumercontroller->parked[i]->cancel();
+	for (size_t i = 0; i < consumercontroller->parked.size(); i++) {
+		consumercontroller->parked[i]->join();
+		delete consumercontroller->parked[i];
+	}
+	consumercontroller->parked.clear();
+
 	return nullptr;
 }
 
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include "ts_queue.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
@@ -31,6 +32,25 @@ int main() {
 	reader->join();
 	writer->join();
 
+	// a parked consumer holds no item and resumes without a new thread
+	p1->request_park();
+	p2->request_park();
+	p1->wait_parked();
+	p2->wait_parked();
+	p1->unpark();
+
+	// at the end of the stream every consumer, parked or not, exits
+	q1->close();
+	p1->cancel();
+	p2->cancel();
+	p1->join();
+	p2->join();
+	p3->join();
+	p4->join();
+	assert(q2->get_size() == 0);
+
+	delete p4;
+	delete p3;
 	delete p2;
 	delete p1;
 	delete writer;
@@ -15,14 +15,17 @@ public:
 	int key;
 	unsigned long long val;
 	char opcode;
+
+	// when the item entered the pipeline, in ns, set only while benchmarking
+	long long timestamp;
 };
 
 // Implementation start
 
-Item::Item() {}
+Item::Item() : timestamp(0) {}
 
 Item::Item(int key, unsigned long long val, char opcode) :
-	key(key), val(val), opcode(opcode) {
+	key(key), val(val), opcode(opcode), timestamp(0) {
 }
 
 Item::~Item() {}
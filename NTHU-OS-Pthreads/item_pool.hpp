@@ -0,0 +1,77 @@
+#include "item.hpp"
+#include "ring_queue.hpp"
+
+#ifndef ITEM_POOL_HPP
+#define ITEM_POOL_HPP
+
+// A fixed set of Items allocated once up front. The Reader acquires an
+// item per line and the Writer releases it after writing, so memory stays
+// bounded however long the input is and no stage calls malloc. The free
+// list is a lock-free MPMC ring; acquire waits (spinning, then yielding)
+// while every item is in flight, which throttles the Reader.
+class ItemPool {
+public:
+	// constructor
+	explicit ItemPool(int capacity);
+
+	// destructor, every item must have been released
+	~ItemPool();
+
+	// take a free item, waits while none is left
+	Item* acquire();
+
+	// take a free item, nullptr when none is left
+	Item* try_acquire();
+
+	// give an item back once nobody uses it any more
+	void release(Item* item);
+
+	int get_capacity();
+
+	// return the number of items currently free
+	int get_free();
+private:
+	int capacity;
+	Item* items;
+	MPMCRingQueue<Item*>* free_list;
+};
+
+// Implementation start
+
+ItemPool::ItemPool(int capacity) : capacity(capacity) {
+	items = new Item[capacity];
+	free_list = aligned_new<MPMCRingQueue<Item*>>(capacity);
+
+	for (int i = 0; i < capacity; i++)
+		free_list->enqueue(&items[i]);
+}
+
+ItemPool::~ItemPool() {
+	aligned_delete(free_list);
+	delete [] items;
+}
+
+Item* ItemPool::acquire() {
+	return free_list->dequeue();
+}
+
+Item* ItemPool::try_acquire() {
+	Item* item;
+	if (free_list->try_dequeue(item))
+		return item;
+	return nullptr;
+}
+
+void ItemPool::release(Item* item) {
+	free_list->enqueue(item);
+}
+
+int ItemPool::get_capacity() {
+	return capacity;
+}
+
+int ItemPool::get_free() {
+	return free_list->get_size();
+}
+
+#endif // ITEM_POOL_HPP
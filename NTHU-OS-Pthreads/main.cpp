@@ -1,72 +1,420 @@
 #include <assert.h>
 #include <stdlib.h>
-#include "ts_queue.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include "queue_factory.hpp"
 #include "item.hpp"
 #include "reader.hpp"
+#include "mmap_reader.hpp"
 #include "writer.hpp"
 #include "producer.hpp"
 #include "consumer_controller.hpp"
+#include "pipeline.hpp"
+#include "affinity.hpp"
+#include "transform_cache.hpp"
+#include "work_stealing_executor.hpp"
+#include "pipeline_monitor.hpp"
+#include "stats.hpp"
 
 #define READER_QUEUE_SIZE 200
 #define WORKER_QUEUE_SIZE 200
 #define WRITER_QUEUE_SIZE 4000
+#define NUM_PRODUCERS 4
 #define CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE 20
 #define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
 #define CONSUMER_CONTROLLER_CHECK_PERIOD 1000000
+// upper bound for scaling policies that size the pool themselves
+#define CONSUMER_CONTROLLER_MAX_CONSUMERS 32
+// TRANSFORM_ITERATIVE (the reference) or TRANSFORM_CLOSED_FORM
+#ifndef TRANSFORM_ENGINE
+#define TRANSFORM_ENGINE TRANSFORM_CLOSED_FORM
+#endif
+// the number of items each thread moves per queue operation
+#ifndef ITEM_BATCH_SIZE
+#define ITEM_BATCH_SIZE 1
+#endif
+// default queue implementation of each stage: QUEUE_TS, QUEUE_TS_SPIN,
+// QUEUE_MPMC_RING, QUEUE_SHARDED
+// (QUEUE_SPSC_RING needs a single thread on both ends, which no default
+// stage has)
+#ifndef READER_QUEUE_KIND
+#define READER_QUEUE_KIND QUEUE_TS
+#endif
+#ifndef WORKER_QUEUE_KIND
+#define WORKER_QUEUE_KIND QUEUE_TS
+#endif
+#ifndef WRITER_QUEUE_KIND
+#define WRITER_QUEUE_KIND QUEUE_TS
+#endif
+// EXECUTOR_THREADS: four producers and a scaling consumer pool,
+// EXECUTOR_WORK_STEALING: one work-stealing worker per cpu runs both stages
+#ifndef PIPELINE_EXECUTOR
+#define PIPELINE_EXECUTOR EXECUTOR_THREADS
+#endif
+// 0 means one worker per online cpu
+#ifndef WORK_STEALING_WORKERS
+#define WORK_STEALING_WORKERS 0
+#endif
+#define WORK_STEALING_BATCH_SIZE 16
+// AFFINITY_NONE, AFFINITY_COMPACT or AFFINITY_PAIRED, see affinity.hpp
+#ifndef PIPELINE_AFFINITY
+#define PIPELINE_AFFINITY AFFINITY_NONE
+#endif
+// the default pool fills every queue, plus this slack for the batches in hand
+#define ITEM_POOL_SLACK 1024
+
+enum ExecutorKind {
+	EXECUTOR_THREADS,
+	EXECUTOR_WORK_STEALING
+};
+
+// usage: ./main n input_file output_file [options]
+//   n of - (or a negative number) streams until the end of the input,
+//   and an input_file of - reads from stdin
+//   --scaling-policy=threshold|pid  how the consumer pool is sized
+//   --ordered-output                write items in input order
+//   --reorder-window=N              items in flight in ordered mode
+//   --reader=stream|mmap            ifstream reader or parallel mmap parser
+//   --writer=stream|buffered|async|direct
+//                                   ofstream, or formatted into large buffers
+//                                   flushed with write(), from a background
+//                                   thread, or with O_DIRECT
+//   --item-pool=N                   items recycled from reader to writer,
+//                                   0 allocates every item with new
+//   --reader-queue-size=N, --worker-queue-size=N, --writer-queue-size=N,
+//   --producers=N, --check-period=US, --low-threshold=PERCENT,
+//   --high-threshold=PERCENT        override the defaults above
+//   --report=FILE                   write throughput and latency as JSON
+//   --occupancy=FILE                write the queue sizes over time as CSV
+//   --sample-period=US              interval between occupancy samples
+//   --stats[=US]                    print per-queue and per-stage counters
+//                                   to stderr at the end, and every US
+//   --reader-queue-kind=KIND, --worker-queue-kind=KIND,
+//   --writer-queue-kind=KIND        override the queue implementations:
+//                                   ts, ts-spin, mpmc, spsc or sharded
+//   --stage=SPEC                    append a transform stage (see
+//                                   pipeline.hpp); when given, the stages
+//                                   replace the default producer/consumer
+//                                   pair and the worker/writer options
+//   --affinity=none|compact|paired  pin the threads to cpus and put each
+//                                   queue buffer on its consumer's node
+//   --transform-cache=N             remember up to N transform results,
+//                                   for inputs that repeat values
+//   --config=FILE                   read more options from FILE, one per
+//                                   line, with or without the leading --;
+//                                   empty lines and # comments are skipped
+
+// how many config files may be read, so one naming itself cannot loop
+#define MAX_CONFIG_FILES 16
+
+// appends the options of a config file to args, false if it cannot be read
+static bool read_config(const std::string& file, std::vector<std::string>& args) {
+	std::ifstream ifs(file);
+	if (!ifs)
+		return false;
+
+	std::string line;
+	while (std::getline(ifs, line)) {
+		std::string::size_type begin = line.find_first_not_of(" \t\r");
+		std::string::size_type end = line.find_last_not_of(" \t\r");
+		if (begin == std::string::npos || line[begin] == '#')
+			continue;
+		line = line.substr(begin, end - begin + 1);
+		args.push_back(line.compare(0, 2, "--") == 0 ? line : "--" + line);
+	}
+	return true;
+}
 
 int main(int argc, char** argv) {
-	assert(argc == 4);
+	assert(argc >= 4);
 
-	int n = atoi(argv[1]);
+	std::string n_arg(argv[1]);
+	int n = n_arg == "-" ? -1 : atoi(argv[1]);
 	std::string input_file_name(argv[2]);
 	std::string output_file_name(argv[3]);
 
-	// TODO: implements main function
+	std::string scaling_policy_name("threshold");
+	bool ordered_output = false;
+	int reorder_window_size = DEFAULT_REORDER_WINDOW_SIZE;
+	std::string reader_kind("stream");
+	int writer_backend = 0;
+	int item_pool_size = -1;
+	int reader_queue_size = READER_QUEUE_SIZE;
+	int worker_queue_size = WORKER_QUEUE_SIZE;
+	int writer_queue_size = WRITER_QUEUE_SIZE;
+	int num_producers = NUM_PRODUCERS;
+	int check_period = CONSUMER_CONTROLLER_CHECK_PERIOD;
+	int low_threshold_percentage = CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE;
+	int high_threshold_percentage = CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE;
+	std::string report_file_name;
+	std::string occupancy_file_name;
+	int sample_period = PIPELINE_MONITOR_SAMPLE_PERIOD;
+	bool stats_enabled = false;
+	int stats_period = 0;
+	QueueKind reader_queue_kind = READER_QUEUE_KIND;
+	QueueKind worker_queue_kind = WORKER_QUEUE_KIND;
+	QueueKind writer_queue_kind = WRITER_QUEUE_KIND;
+	std::vector<StageSpec> stages;
+	int config_files = 0;
+	AffinityPolicy affinity_policy = PIPELINE_AFFINITY;
+	int transform_cache_size = 0;
 
-	TSQueue<Item*>* input_q = new TSQueue<Item*>(READER_QUEUE_SIZE);
-	TSQueue<Item*>* worker_q = new TSQueue<Item*>(WORKER_QUEUE_SIZE);
-	TSQueue<Item*>* output_q = new TSQueue<Item*>(WRITER_QUEUE_SIZE);
-	/*TSQueue<Item*>* input_q = new TSQueue<Item*>(n);
-	TSQueue<Item*>* worker_q = new TSQueue<Item*>(n);
-	TSQueue<Item*>* output_q = new TSQueue<Item*>(n);*/
-	Transformer* transformer = new Transformer;
+	std::vector<std::string> args(argv + 4, argv + argc);
+	for (size_t i = 0; i < args.size(); i++) {
+		std::string arg(args[i]);
+		std::string::size_type eq = arg.find('=');
+		std::string key = arg.substr(0, eq);
+		std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
 
-	Reader* reader = new Reader(n, input_file_name, input_q);
-	Writer* writer = new Writer(n, output_file_name, output_q);
+		if (key == "--scaling-policy") {
+			scaling_policy_name = value;
+		} else if (key == "--ordered-output") {
+			ordered_output = true;
+		} else if (key == "--reorder-window") {
+			reorder_window_size = atoi(value.c_str());
+			if (reorder_window_size <= 0) {
+				std::cerr << "invalid reorder window: " << value << std::endl;
+				return 1;
+			}
+		} else if (key == "--item-pool") {
+			if (!parse_int_option(value, 0, item_pool_size)) {
+				std::cerr << "invalid item pool size: " << value << std::endl;
+				return 1;
+			}
+		} else if (key == "--reader-queue-size" && parse_int_option(value, 1, reader_queue_size)) {
+		} else if (key == "--worker-queue-size" && parse_int_option(value, 1, worker_queue_size)) {
+		} else if (key == "--writer-queue-size" && parse_int_option(value, 1, writer_queue_size)) {
+		} else if (key == "--producers" && parse_int_option(value, 1, num_producers)) {
+		} else if (key == "--check-period" && parse_int_option(value, 1, check_period)) {
+		} else if (key == "--low-threshold" && parse_int_option(value, 0, low_threshold_percentage)) {
+		} else if (key == "--high-threshold" && parse_int_option(value, 0, high_threshold_percentage)) {
+		} else if (key == "--sample-period" && parse_int_option(value, 1, sample_period)) {
+		} else if (key == "--stats" && (eq == std::string::npos || parse_int_option(value, 1, stats_period))) {
+			stats_enabled = true;
+		} else if (key == "--reader-queue-kind" && parse_queue_kind(value, reader_queue_kind)) {
+		} else if (key == "--worker-queue-kind" && parse_queue_kind(value, worker_queue_kind)) {
+		} else if (key == "--writer-queue-kind" && parse_queue_kind(value, writer_queue_kind)) {
+		} else if (key == "--affinity" && parse_affinity_policy(value, affinity_policy)) {
+		} else if (key == "--transform-cache" && parse_int_option(value, 0, transform_cache_size)) {
+		} else if (key == "--stage") {
+			StageSpec spec;
+			std::string error;
+			if (!parse_stage_spec(value, spec, error)) {
+				std::cerr << error << std::endl;
+				return 1;
+			}
+			stages.push_back(spec);
+		} else if (key == "--config") {
+			// the options of the file take effect right where it is named
+			std::vector<std::string> included;
+			if (++config_files > MAX_CONFIG_FILES) {
+				std::cerr << "too many config files: " << value << std::endl;
+				return 1;
+			}
+			if (!read_config(value, included)) {
+				std::cerr << "cannot read " << value << std::endl;
+				return 1;
+			}
+			args.insert(args.begin() + i + 1, included.begin(), included.end());
+		} else if (key == "--report" && !value.empty()) {
+			report_file_name = value;
+		} else if (key == "--occupancy" && !value.empty()) {
+			occupancy_file_name = value;
+		} else if (key == "--reader" && (value == "stream" || value == "mmap")) {
+			reader_kind = value;
+		} else if (key == "--writer" && value == "stream") {
+			writer_backend = 0;
+		} else if (key == "--writer" && value == "buffered") {
+			writer_backend = WRITER_BUFFERED;
+		} else if (key == "--writer" && value == "async") {
+			writer_backend = WRITER_BUFFERED | WRITER_ASYNC;
+		} else if (key == "--writer" && value == "direct") {
+			writer_backend = WRITER_BUFFERED | WRITER_DIRECT;
+		} else {
+			std::cerr << "unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
 
-	Producer* p1 = new Producer(input_q, worker_q, transformer);
-	Producer* p2 = new Producer(input_q, worker_q, transformer);
-	Producer* p3 = new Producer(input_q, worker_q, transformer);
-	Producer* p4 = new Producer(input_q, worker_q, transformer);
-	int check_period = CONSUMER_CONTROLLER_CHECK_PERIOD;
-	int low_threshold = (WORKER_QUEUE_SIZE * CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE) / 100;
-	int high_threshold = (WORKER_QUEUE_SIZE * CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE) / 100;
+	if (reader_kind == "mmap" && input_file_name == "-") {
+		std::cerr << "the mmap reader cannot read from stdin" << std::endl;
+		return 1;
+	}
+
+	// without --stage, the classic pair: a fixed pool of producers, then
+	// a scaling pool of consumers
+	if (stages.empty()) {
+		StageSpec producer;
+		producer.transform = "producer";
+		producer.threads = num_producers;
+		producer.queue_kind = worker_queue_kind;
+		producer.queue_capacity = worker_queue_size;
+		stages.push_back(producer);
+
+		StageSpec consumer;
+		consumer.transform = "consumer";
+		consumer.scaling = scaling_policy_name;
+		consumer.check_period = check_period;
+		consumer.low_percentage = low_threshold_percentage;
+		consumer.high_percentage = high_threshold_percentage;
+		consumer.max_threads = CONSUMER_CONTROLLER_MAX_CONSUMERS;
+		consumer.queue_kind = writer_queue_kind;
+		consumer.queue_capacity = writer_queue_size;
+		stages.push_back(consumer);
+
+		ScalingPolicy* policy = make_scaling_policy(scaling_policy_name, 0, 0, 1);
+		if (policy == nullptr) {
+			std::cerr << "unknown scaling policy: " << scaling_policy_name << std::endl;
+			return 1;
+		}
+		delete policy;
+	} else if (PIPELINE_EXECUTOR == EXECUTOR_WORK_STEALING) {
+		std::cerr << "the work-stealing executor runs a fixed pair of stages, --stage is not supported" << std::endl;
+		return 1;
+	}
+
+	std::string error;
+	if (!validate_stages(stages, reader_queue_kind, error)) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	if (item_pool_size < 0) {
+		item_pool_size = reader_queue_size + ITEM_POOL_SLACK;
+		for (size_t i = 0; i < stages.size(); i++)
+			item_pool_size += stages[i].queue_capacity;
+	}
+
+	Queue<Item*>* input_q = make_queue<Item*>(reader_queue_kind, reader_queue_size);
+	Transformer* transformer = new Transformer(TRANSFORM_ENGINE);
+
+	ReorderWindow* window = ordered_output ? new ReorderWindow(reorder_window_size) : nullptr;
+	ItemPool* pool = item_pool_size > 0 ? new ItemPool(item_pool_size) : nullptr;
 
-	ConsumerController* consumercontroller = new ConsumerController(worker_q, output_q, transformer , check_period, low_threshold, high_threshold);
+	StatsRegistry* stats = stats_enabled ? new StatsRegistry : nullptr;
+	StatsReporter* stats_reporter = stats && stats_period > 0 ? new StatsReporter(stats, stats_period) : nullptr;
+
+	PipelineMonitor* monitor = nullptr;
+	if (!report_file_name.empty() || !occupancy_file_name.empty())
+		monitor = new PipelineMonitor(sample_period);
+
+	// cpus are handed out in pipeline order: reader, stages, writer; the
+	// mmap reader stays unpinned, its parser threads would inherit its cpu
+	AffinityPlan* affinity = affinity_policy != AFFINITY_NONE ? new AffinityPlan(affinity_policy) : nullptr;
+	std::vector<int> reader_cpus;
+	if (affinity && reader_kind != "mmap")
+		reader_cpus = affinity->assign_single();
+
+	// the work-stealing executor transforms item by item and does not use it
+	TransformCache* transform_cache = transform_cache_size > 0 ? new TransformCache(transform_cache_size) : nullptr;
+
+	Pipeline* pipeline = nullptr;
+	WorkStealingExecutor* executor = nullptr;
+	Queue<Item*>* output_q;
+
+	if (PIPELINE_EXECUTOR == EXECUTOR_WORK_STEALING) {
+		output_q = make_queue<Item*>(writer_queue_kind, writer_queue_size);
+		executor = new WorkStealingExecutor(input_q, output_q, transformer, WORK_STEALING_WORKERS, WORK_STEALING_BATCH_SIZE);
+	} else {
+		pipeline = new Pipeline(input_q, stages, transformer, ITEM_BATCH_SIZE, stats, affinity, transform_cache);
+		output_q = pipeline->get_output_queue();
+	}
+
+	// the queues, in pipeline order, for the counters and the sampler
+	std::vector<std::string> queue_names(1, "input");
+	std::vector<Queue<Item*>*> queues(1, input_q);
+	if (pipeline) {
+		for (int i = 0; i < pipeline->get_num_stages(); i++) {
+			queue_names.push_back(pipeline->get_queue_name(i));
+			queues.push_back(pipeline->get_queue(i));
+		}
+	} else {
+		queue_names.push_back("output");
+		queues.push_back(output_q);
+	}
+
+	for (size_t i = 0; i < queues.size(); i++) {
+		if (stats)
+			stats->add_queue(queue_names[i], queues[i]);
+		if (monitor)
+			monitor->add_queue(queue_names[i], queues[i]);
+	}
+
+	Thread* reader;
+	if (reader_kind == "mmap")
+		reader = new MmapReader(n, input_file_name, input_q, ITEM_BATCH_SIZE, window, pool, monitor);
+	else
+		reader = new Reader(n, input_file_name, input_q, ITEM_BATCH_SIZE, window, pool, monitor);
+	std::vector<int> writer_cpus;
+	if (affinity) {
+		writer_cpus = affinity->assign_single();
+		affinity->place(output_q, writer_cpus);
+	}
+
+	Writer* writer = new Writer(n, output_file_name, output_q, ITEM_BATCH_SIZE, window, writer_backend, pool, monitor);
+
+	if (monitor)
+		monitor->start();
+	if (stats_reporter)
+		stats_reporter->start();
 
 	reader->start();
 	writer->start();
+	pin_thread(reader, reader_cpus, 0);
+	pin_thread(writer, writer_cpus, 0);
 
-	p1->start();
-	p2->start();
-	p3->start();
-	p4->start();
+	if (executor)
+		executor->start();
+	else
+		pipeline->start();
 
-	consumercontroller->start();
-	
+	// shut down stage by stage: once every thread writing into a queue
+	// has been joined the queue is closed, and its readers drain it and stop
 	reader->join();
+	input_q->close();
+
+	if (executor) {
+		executor->join();
+		output_q->close();
+	} else {
+		pipeline->join();
+	}
+
 	writer->join();
 
-	delete p4;
-	delete p3;
-	delete p2;
-	delete p1;
+	if (monitor) {
+		monitor->stop();
+		if (!report_file_name.empty() && !monitor->write_report(report_file_name))
+			std::cerr << "cannot write " << report_file_name << std::endl;
+		if (!occupancy_file_name.empty() && !monitor->write_occupancy(occupancy_file_name))
+			std::cerr << "cannot write " << occupancy_file_name << std::endl;
+	}
+
+	if (stats_reporter)
+		stats_reporter->stop();
+	if (stats) {
+		stats->print(std::cerr);
+		if (transform_cache)
+			transform_cache->print(std::cerr);
+	}
+
 	delete writer;
 	delete reader;
-	delete consumercontroller;
-	delete input_q;
-	delete worker_q;
-	delete output_q;
+	// the pipeline owns its queues, the executor does not
+	if (executor)
+		destroy_queue(output_q);
+	delete executor;
+	delete pipeline;
+	delete affinity;
+	delete transform_cache;
+	delete transformer;
+	delete window;
+	delete pool;
+	delete monitor;
+	delete stats_reporter;
+	delete stats;
+	destroy_queue(input_q);
 
 	return 0;
 }
@@ -0,0 +1,383 @@
+#include <pthread.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <iostream>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "ts_queue.hpp"
+#include "spin_wait.hpp"
+#include "item.hpp"
+#include "reorder_window.hpp"
+#include "item_pool.hpp"
+#include "pipeline_monitor.hpp"
+
+#ifndef MMAP_READER_HPP
+#define MMAP_READER_HPP
+
+// a chunk smaller than this is not worth its own parser thread
+#define MMAP_READER_MIN_CHUNK_SIZE (64 * 1024)
+// the most items a parser passes to the reader thread at once
+#define MMAP_READER_HANDOFF_SIZE 256
+
+// Reads the input without iostreams: the file is mapped, cut into chunks
+// on newline boundaries, and every chunk is parsed by its own thread. A
+// parser hands its items to the reader thread through its own bounded
+// queue, and the reader thread drains the queues in file order, so items
+// enter the pipeline in the same order as with Reader.
+// Without a pool, a chunk is parsed into one preallocated block of Items
+// and its queue holds the whole chunk, so parsers never wait. With a
+// pool, lines are parsed straight into pool items, and the queues of the
+// chunks ahead of the one being drained may together hold at most half
+// the pool, so memory stays bounded by the pool and the chunk being
+// drained can always get items back from the Writer.
+class MmapReader : public Thread {
+public:
+	// constructor, num_parsers <= 0 means one parser per online cpu,
+	// a negative expected_lines reads the whole file
+	MmapReader(
+		int expected_lines,
+		std::string input_file,
+		Queue<Item*>* input_queue,
+		int batch_size = 1,
+		ReorderWindow* window = nullptr,
+		ItemPool* pool = nullptr,
+		PipelineMonitor* monitor = nullptr,
+		int num_parsers = 0
+	);
+
+	// destructor, frees the item blocks
+	~MmapReader();
+
+	virtual void start() override;
+private:
+	struct Chunk {
+		pthread_t t;
+		MmapReader* reader;
+		const char* begin;
+		const char* end;
+		// without a pool, the block the items of this chunk are parsed into
+		Item* items;
+		// the parsed items, in file order, closed once the chunk is done
+		TSQueue<Item*>* parsed;
+		// items a parser collects before it passes them on
+		int handoff_size;
+	};
+
+	int expected_lines;
+	std::string input_file;
+	Queue<Item*>* input_queue;
+	int batch_size;
+	ReorderWindow* window;
+	ItemPool* pool;
+	PipelineMonitor* monitor;
+	int num_parsers;
+
+	Chunk* chunks;
+	int num_chunks;
+
+	// set once the reader thread needs no more items, parsers stop early
+	std::atomic<bool> stopped;
+
+	// the method for pthread to create a reader thread
+	static void* process(void* arg);
+
+	// the method for pthread to parse one chunk
+	static void* parse(void* arg);
+};
+
+// Implementation start
+
+// digits are parsed with one subtract and one unsigned compare per byte
+static inline const char* parse_digits(const char* p, const char* end, unsigned long long& val) {
+	unsigned long long v = 0;
+	unsigned d;
+
+	while (p < end && (d = (unsigned char)*p - '0') < 10) {
+		v = v * 10 + d;
+		p++;
+	}
+
+	val = v;
+	return p;
+}
+
+static inline const char* skip_blanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+MmapReader::MmapReader(
+	int expected_lines,
+	std::string input_file,
+	Queue<Item*>* input_queue,
+	int batch_size,
+	ReorderWindow* window,
+	ItemPool* pool,
+	PipelineMonitor* monitor,
+	int num_parsers
+) : expected_lines(expected_lines),
+	input_file(input_file),
+	input_queue(input_queue),
+	batch_size(batch_size),
+	window(window),
+	pool(pool),
+	monitor(monitor),
+	num_parsers(num_parsers) {
+	if (this->num_parsers <= 0)
+		this->num_parsers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (this->num_parsers <= 0)
+		this->num_parsers = 1;
+
+	chunks = nullptr;
+	num_chunks = 0;
+	stopped.store(false);
+}
+
+MmapReader::~MmapReader() {
+	for (int i = 0; i < num_chunks; i++) {
+		delete chunks[i].parsed;
+		delete [] chunks[i].items;
+	}
+	delete [] chunks;
+}
+
+void MmapReader::start() {
+	pthread_create(&t, 0, MmapReader::process, (void*)this);
+}
+
+void* MmapReader::parse(void* arg) {
+	Chunk* chunk = (Chunk*)arg;
+	MmapReader* reader = chunk->reader;
+	ItemPool* pool = reader->pool;
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+
+	Item** handoff = new Item*[chunk->handoff_size];
+	int count = 0;
+	int parsed = 0;
+
+	while (p < end && !reader->stopped.load(std::memory_order_relaxed)) {
+		p = skip_blanks(p, end);
+		if (p < end && *p == '\n') {
+			p++;
+			continue;
+		}
+		if (p >= end)
+			break;
+
+		Item* item;
+		if (pool == nullptr) {
+			item = &chunk->items[parsed];
+		} else if ((item = pool->try_acquire()) == nullptr) {
+			// what we hold may be what the reader thread waits for
+			// before the Writer can free an item
+			chunk->parsed->enqueue_bulk(handoff, count);
+			count = 0;
+
+			SpinWait spin;
+			while ((item = pool->try_acquire()) == nullptr && !reader->stopped.load(std::memory_order_relaxed))
+				spin.wait();
+			if (item == nullptr)
+				break;
+		}
+
+		unsigned long long key;
+
+		bool negative = (*p == '-');
+		if (negative)
+			p++;
+		p = parse_digits(p, end, key);
+		item->key = negative ? -(int)key : (int)key;
+
+		p = skip_blanks(p, end);
+		p = parse_digits(p, end, item->val);
+
+		p = skip_blanks(p, end);
+		item->opcode = p < end ? *p++ : 0;
+
+		// drop anything else up to the end of the line
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		p = eol ? eol + 1 : end;
+
+		parsed++;
+		handoff[count++] = item;
+		if (count == chunk->handoff_size) {
+			chunk->parsed->enqueue_bulk(handoff, count);
+			count = 0;
+		}
+	}
+
+	chunk->parsed->enqueue_bulk(handoff, count);
+	chunk->parsed->close();
+
+	delete [] handoff;
+	return nullptr;
+}
+
+// the lines of a chunk, an upper bound on the items it parses into
+static int count_lines(const char* p, const char* end) {
+	int lines = 0;
+	for (const char* q = p; q < end && (q = (const char*)memchr(q, '\n', end - q)) != nullptr; q++)
+		lines++;
+	if (end > p && end[-1] != '\n')
+		lines++;
+	return lines;
+}
+
+void* MmapReader::process(void* arg) {
+	MmapReader* reader = (MmapReader*)arg;
+
+	int fd = open(reader->input_file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "cannot open " << reader->input_file << std::endl;
+		return nullptr;
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+	size_t size = st.st_size;
+
+	const char* data = nullptr;
+	if (size > 0) {
+		data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			std::cerr << "cannot map " << reader->input_file << std::endl;
+			close(fd);
+			return nullptr;
+		}
+		madvise((void*)data, size, MADV_SEQUENTIAL);
+	}
+
+	// cut the file into chunks that end right after a newline
+	int max_chunks = size / MMAP_READER_MIN_CHUNK_SIZE + 1;
+	if (max_chunks > reader->num_parsers)
+		max_chunks = reader->num_parsers;
+
+	// with a pool, every chunk but the one being drained may hold a queue
+	// and a handoff of pool items; keep them to half the pool in total
+	int budget = 0;
+	if (reader->pool) {
+		int capacity = reader->pool->get_capacity();
+		if (max_chunks > capacity / 8)
+			max_chunks = capacity / 8 > 1 ? capacity / 8 : 1;
+		budget = capacity / 2 / max_chunks;
+		if (budget > 2 * MMAP_READER_HANDOFF_SIZE)
+			budget = 2 * MMAP_READER_HANDOFF_SIZE;
+		if (budget < 2)
+			budget = 2;
+	}
+
+	reader->chunks = new Chunk[max_chunks];
+	reader->num_chunks = 0;
+
+	const char* begin = data;
+	const char* end = data + size;
+	for (int i = 0; i < max_chunks && begin < end; i++) {
+		const char* cut = end;
+		if (i + 1 < max_chunks) {
+			cut = begin + (end - begin) / (max_chunks - i);
+			const char* eol = (const char*)memchr(cut, '\n', end - cut);
+			cut = eol ? eol + 1 : end;
+		}
+
+		Chunk* chunk = &reader->chunks[reader->num_chunks++];
+		chunk->reader = reader;
+		chunk->begin = begin;
+		chunk->end = cut;
+		chunk->items = nullptr;
+		if (reader->pool) {
+			chunk->parsed = new TSQueue<Item*>(budget / 2);
+			chunk->handoff_size = budget / 2;
+		} else {
+			int lines = count_lines(begin, cut);
+			chunk->items = new Item[lines];
+			chunk->parsed = new TSQueue<Item*>(lines > 0 ? lines : 1);
+			chunk->handoff_size = MMAP_READER_HANDOFF_SIZE;
+		}
+		pthread_create(&chunk->t, 0, MmapReader::parse, (void*)chunk);
+
+		begin = cut;
+	}
+
+	// hand the items over in file order as the parsers pass them on
+	Item** batch = new Item*[reader->batch_size];
+	Item** parsed = new Item*[MMAP_READER_HANDOFF_SIZE];
+	int count = 0;
+
+	for (int i = 0; i < reader->num_chunks && reader->expected_lines != 0; i++) {
+		Chunk* chunk = &reader->chunks[i];
+
+		while (reader->expected_lines != 0) {
+			// the parser may be waiting for a pool item held in our batch
+			if (reader->pool && chunk->parsed->get_size() == 0) {
+				reader->input_queue->enqueue_bulk(batch, count);
+				count = 0;
+			}
+
+			int got = chunk->parsed->dequeue_bulk(parsed, MMAP_READER_HANDOFF_SIZE);
+			if (got == 0)
+				break;
+
+			int j;
+			for (j = 0; j < got && reader->expected_lines != 0; j++) {
+				Item* item = parsed[j];
+
+				if (reader->window && !reader->window->try_admit(item->key)) {
+					reader->input_queue->enqueue_bulk(batch, count);
+					count = 0;
+					reader->window->admit(item->key);
+				}
+
+				if (reader->monitor)
+					reader->monitor->stamp(item);
+
+				batch[count++] = item;
+				if (reader->expected_lines > 0)
+					reader->expected_lines--;
+
+				if (count == reader->batch_size) {
+					reader->input_queue->enqueue_bulk(batch, count);
+					count = 0;
+				}
+			}
+
+			// past expected_lines, the rest goes back unused
+			if (reader->pool) {
+				for (; j < got; j++)
+					reader->pool->release(parsed[j]);
+			}
+		}
+	}
+
+	if (count > 0)
+		reader->input_queue->enqueue_bulk(batch, count);
+
+	delete [] batch;
+
+	// stop the parsers still running, taking back what they hand over
+	reader->stopped.store(true, std::memory_order_relaxed);
+	for (int i = 0; i < reader->num_chunks; i++) {
+		Chunk* chunk = &reader->chunks[i];
+		int got;
+		while ((got = chunk->parsed->dequeue_bulk(parsed, MMAP_READER_HANDOFF_SIZE)) > 0) {
+			for (int j = 0; reader->pool && j < got; j++)
+				reader->pool->release(parsed[j]);
+		}
+		pthread_join(chunk->t, 0);
+	}
+	delete [] parsed;
+
+	if (data)
+		munmap((void*)data, size);
+	close(fd);
+
+	return nullptr;
+}
+
+#endif // MMAP_READER_HPP
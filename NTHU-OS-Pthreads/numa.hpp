@@ -0,0 +1,158 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <new>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+// the nodes the kernel may report, one bit each in an mbind mask
+#define NUMA_MAX_NODES 64
+
+// The online cpus and the memory node each belongs to, read from sysfs.
+// Machines (or containers) without /sys/devices/system/node are treated
+// as a single node holding every online cpu.
+class CpuTopology {
+public:
+	CpuTopology();
+
+	// the online cpus, grouped by node, then in increasing order
+	const std::vector<int>& get_cpus();
+
+	// the node of a cpu, 0 if it is unknown
+	int node_of(int cpu);
+private:
+	std::vector<int> cpus;
+	// indexed by cpu
+	std::vector<int> nodes;
+
+	// parses a sysfs cpu list such as "0-3,8-11" into cpus
+	static void parse_cpu_list(const std::string& list, std::vector<int>& cpus);
+};
+
+// the length of a buffer of len bytes rounded up to whole pages
+inline size_t numa_buffer_size(size_t len) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (len + page - 1) / page * page;
+}
+
+// Maps a buffer on pages of its own, so binding it to a node never
+// affects another object. The pages are only backed once written.
+inline void* numa_alloc(size_t len) {
+	void* addr = mmap(NULL, numa_buffer_size(len), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return addr == MAP_FAILED ? nullptr : addr;
+}
+
+inline void numa_free(void* addr, size_t len) {
+	munmap(addr, numa_buffer_size(len));
+}
+
+// Asks the kernel to back a numa_alloc buffer from a memory node; pages
+// already written are left where they are, so bind before the first write.
+// Returns false if the kernel refused (no NUMA support, bad node).
+inline bool numa_bind(void* addr, size_t len, int node) {
+	if (len == 0 || node < 0 || node >= NUMA_MAX_NODES)
+		return false;
+
+	unsigned long mask = 1UL << node;
+	return syscall(SYS_mbind, addr, numa_buffer_size(len), MPOL_PREFERRED, &mask, NUMA_MAX_NODES + 1, 0) == 0;
+}
+
+// n value-initialized Ts in a numa_alloc buffer, bound to node first
+// unless node is negative; released with numa_delete_array
+template <class T>
+T* numa_new_array(size_t n, int node = -1) {
+	void* addr = numa_alloc(sizeof(T) * n);
+	if (addr == nullptr)
+		throw std::bad_alloc();
+	if (node >= 0)
+		numa_bind(addr, sizeof(T) * n, node);
+
+	T* array = (T*)addr;
+	for (size_t i = 0; i < n; i++)
+		new (&array[i]) T();
+	return array;
+}
+
+template <class T>
+void numa_delete_array(T* array, size_t n) {
+	if (array == nullptr)
+		return;
+	for (size_t i = 0; i < n; i++)
+		array[i].~T();
+	numa_free(array, sizeof(T) * n);
+}
+
+// Implementation start
+
+CpuTopology::CpuTopology() {
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	std::vector<int> online;
+
+	std::ifstream online_file("/sys/devices/system/cpu/online");
+	std::string list;
+	if (online_file && std::getline(online_file, list))
+		parse_cpu_list(list, online);
+	if (online.empty()) {
+		for (int i = 0; i < num_cpus; i++)
+			online.push_back(i);
+	}
+
+	nodes.assign(*std::max_element(online.begin(), online.end()) + 1, 0);
+
+	// node by node, so the cpus of one node end up next to each other
+	for (int node = 0; node < NUMA_MAX_NODES; node++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		std::ifstream ifs(path);
+		if (!ifs || !std::getline(ifs, list))
+			continue;
+
+		std::vector<int> node_cpus;
+		parse_cpu_list(list, node_cpus);
+		for (size_t i = 0; i < node_cpus.size(); i++) {
+			int cpu = node_cpus[i];
+			if (std::find(online.begin(), online.end(), cpu) == online.end())
+				continue;
+			nodes[cpu] = node;
+			cpus.push_back(cpu);
+		}
+	}
+
+	// no node information, one node with every online cpu
+	if (cpus.empty())
+		cpus = online;
+}
+
+const std::vector<int>& CpuTopology::get_cpus() {
+	return cpus;
+}
+
+int CpuTopology::node_of(int cpu) {
+	if (cpu < 0 || cpu >= (int)nodes.size())
+		return 0;
+	return nodes[cpu];
+}
+
+void CpuTopology::parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		int first, last;
+		if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+			for (int cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		} else if (sscanf(range.c_str(), "%d", &first) == 1) {
+			cpus.push_back(first);
+		}
+	}
+}
+
+#endif // NUMA_HPP
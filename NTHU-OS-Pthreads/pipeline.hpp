@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "queue.hpp"
+#include "queue_factory.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+#include "transform_batch.hpp"
+#include "transform_cache.hpp"
+#include "producer.hpp"
+#include "consumer_controller.hpp"
+#include "scaling_policy.hpp"
+#include "stats.hpp"
+#include "affinity.hpp"
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#define STAGE_DEFAULT_THREADS 4
+#define STAGE_DEFAULT_QUEUE_CAPACITY 200
+#define STAGE_DEFAULT_CHECK_PERIOD 1000000
+#define STAGE_DEFAULT_LOW_PERCENTAGE 20
+#define STAGE_DEFAULT_HIGH_PERCENTAGE 80
+#define STAGE_DEFAULT_MAX_THREADS 32
+
+// One transform stage: which transform it applies, how many threads run
+// it, and the queue it writes into (the next stage's or the writer's).
+// Written as "transform[,key=value...]", for example
+//   producer,threads=4,queue=ts,capacity=200
+//   consumer,scaling=pid,queue=mpmc,capacity=4000,period=100000,max=16
+//   producer,threads=8,queue=sharded,lanes=8
+// A stage has a fixed pool of threads unless a scaling policy is given,
+// in which case a ConsumerController sizes its pool between 1 and max.
+struct StageSpec {
+	StageSpec();
+
+	// "producer" or "consumer"
+	std::string transform;
+
+	int threads;
+	// empty for a fixed pool, else "threshold" or "pid"
+	std::string scaling;
+	// the controller's check period (us), its thresholds as percentages
+	// of the input queue and the largest pool it may grow to
+	int check_period;
+	int low_percentage;
+	int high_percentage;
+	int max_threads;
+
+	QueueKind queue_kind;
+	int queue_capacity;
+	// the lanes of a sharded queue, 0 for one per thread of a fixed pool
+	// (STAGE_DEFAULT_THREADS for a scaling one)
+	int queue_lanes;
+};
+
+// parses a stage description, false with a message on any error
+bool parse_stage_spec(const std::string& text, StageSpec& spec, std::string& error);
+
+// checks a whole chain fed by an input queue of input_kind; an SPSC ring
+// is only allowed between two fixed single-thread ends
+bool validate_stages(const std::vector<StageSpec>& stages, QueueKind input_kind, std::string& error);
+
+// Builds the transform stages between the reader's queue and the writer
+// and owns their threads and output queues.
+class Pipeline {
+public:
+	// Constructor, the stages must have passed validate_stages. With an
+	// affinity plan, each stage takes its cpus from it in order, and the
+	// input queue and every queue but the last (the writer's, for the
+	// caller to place) move to the node of the stage that drains them.
+	// With a cache, every stage looks its results up there first.
+	Pipeline(
+		Queue<Item*>* input_queue,
+		const std::vector<StageSpec>& stages,
+		Transformer* transformer,
+		int batch_size = 1,
+		StatsRegistry* stats = nullptr,
+		AffinityPlan* affinity = nullptr,
+		TransformCache* cache = nullptr
+	);
+
+	// destructor, deletes the threads and the queues it created
+	~Pipeline();
+
+	void start();
+
+	// Waits for the stages in order. The input queue must be closed by
+	// then (or later); after each stage has stopped, its output queue is
+	// closed, which in turn stops the next stage.
+	void join();
+
+	int get_num_stages();
+
+	// the queue stage i writes into
+	Queue<Item*>* get_queue(int stage);
+
+	// "worker1", "worker2", ..., and "output" for the last one
+	std::string get_queue_name(int stage);
+
+	// the queue the writer reads
+	Queue<Item*>* get_output_queue();
+private:
+	struct Stage {
+		std::vector<Producer*> threads;
+		ConsumerController* controller;
+		Queue<Item*>* output_queue;
+		// empty when the threads float
+		std::vector<int> cpus;
+	};
+
+	std::vector<Stage> stages;
+};
+
+// Implementation start
+
+StageSpec::StageSpec() {
+	threads = STAGE_DEFAULT_THREADS;
+	check_period = STAGE_DEFAULT_CHECK_PERIOD;
+	low_percentage = STAGE_DEFAULT_LOW_PERCENTAGE;
+	high_percentage = STAGE_DEFAULT_HIGH_PERCENTAGE;
+	max_threads = STAGE_DEFAULT_MAX_THREADS;
+	queue_kind = QUEUE_TS;
+	queue_capacity = STAGE_DEFAULT_QUEUE_CAPACITY;
+	queue_lanes = 0;
+}
+
+// parses a decimal value of at least min, false if it is not one
+inline bool parse_int_option(const std::string& value, int min, int& out) {
+	char* end;
+	long ret = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || ret < min || ret > 0x7fffffff)
+		return false;
+	out = ret;
+	return true;
+}
+
+bool parse_stage_spec(const std::string& text, StageSpec& spec, std::string& error) {
+	spec = StageSpec();
+
+	std::vector<std::string> fields;
+	std::string::size_type begin = 0;
+	while (1) {
+		std::string::size_type comma = text.find(',', begin);
+		fields.push_back(text.substr(begin, comma == std::string::npos ? std::string::npos : comma - begin));
+		if (comma == std::string::npos)
+			break;
+		begin = comma + 1;
+	}
+
+	spec.transform = fields[0];
+	if (spec.transform != "producer" && spec.transform != "consumer") {
+		error = "unknown transform: " + spec.transform;
+		return false;
+	}
+
+	for (size_t i = 1; i < fields.size(); i++) {
+		std::string::size_type eq = fields[i].find('=');
+		std::string key = fields[i].substr(0, eq);
+		std::string value = eq == std::string::npos ? "" : fields[i].substr(eq + 1);
+
+		bool ok;
+		if (key == "threads")
+			ok = parse_int_option(value, 1, spec.threads);
+		else if (key == "scaling") {
+			ScalingPolicy* policy = make_scaling_policy(value, 0, 0, 1);
+			ok = policy != nullptr;
+			delete policy;
+			spec.scaling = value;
+		} else if (key == "period")
+			ok = parse_int_option(value, 1, spec.check_period);
+		else if (key == "low")
+			ok = parse_int_option(value, 0, spec.low_percentage);
+		else if (key == "high")
+			ok = parse_int_option(value, 0, spec.high_percentage);
+		else if (key == "max")
+			ok = parse_int_option(value, 1, spec.max_threads);
+		else if (key == "queue")
+			ok = parse_queue_kind(value, spec.queue_kind);
+		else if (key == "capacity")
+			ok = parse_int_option(value, 1, spec.queue_capacity);
+		else if (key == "lanes")
+			ok = parse_int_option(value, 1, spec.queue_lanes);
+		else
+			ok = false;
+
+		if (!ok) {
+			error = "invalid stage field: " + fields[i];
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool validate_stages(const std::vector<StageSpec>& stages, QueueKind input_kind, std::string& error) {
+	if (stages.empty()) {
+		error = "the pipeline needs at least one stage";
+		return false;
+	}
+
+	for (size_t i = 0; i < stages.size(); i++) {
+		bool single = stages[i].scaling.empty() && stages[i].threads == 1;
+
+		// the reader is a single thread, and so is the writer
+		bool input_spsc = i == 0 ? input_kind == QUEUE_SPSC_RING : stages[i - 1].queue_kind == QUEUE_SPSC_RING;
+		bool output_spsc = stages[i].queue_kind == QUEUE_SPSC_RING;
+
+		if ((input_spsc || output_spsc) && !single) {
+			error = "an spsc queue needs a single-thread stage on both ends";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+Pipeline::Pipeline(
+	Queue<Item*>* input_queue,
+	const std::vector<StageSpec>& specs,
+	Transformer* transformer,
+	int batch_size,
+	StatsRegistry* stats,
+	AffinityPlan* affinity,
+	TransformCache* cache
+) {
+	Queue<Item*>* in = input_queue;
+
+	for (size_t i = 0; i < specs.size(); i++) {
+		const StageSpec& spec = specs[i];
+		TransformMany many = spec.transform == "producer" ? &Transformer::producer_transform_many : &Transformer::consumer_transform_many;
+		std::string name = std::to_string(i + 1) + " " + spec.transform;
+
+		Stage stage;
+		stage.controller = nullptr;
+		int lanes = spec.queue_lanes;
+		if (lanes == 0)
+			lanes = spec.scaling.empty() ? spec.threads : STAGE_DEFAULT_THREADS;
+		stage.output_queue = make_queue<Item*>(spec.queue_kind, spec.queue_capacity, lanes);
+		if (affinity) {
+			stage.cpus = affinity->assign(spec.scaling.empty() ? spec.threads : spec.max_threads);
+			affinity->place(in, stage.cpus);
+		}
+
+		if (spec.scaling.empty()) {
+			for (int j = 0; j < spec.threads; j++)
+				stage.threads.push_back(new Producer(in, stage.output_queue, transformer, batch_size, stats ? stats->register_thread(name) : nullptr, many, cache));
+		} else {
+			int capacity = in->get_buffer_size();
+			int low_threshold = (capacity * spec.low_percentage) / 100;
+			int high_threshold = (capacity * spec.high_percentage) / 100;
+			ScalingPolicy* policy = make_scaling_policy(spec.scaling, low_threshold, high_threshold, spec.max_threads);
+
+			stage.controller = new ConsumerController(in, stage.output_queue, transformer, spec.check_period, low_threshold, high_threshold, batch_size, policy, stats, many, name, cache);
+			stage.controller->set_cpus(stage.cpus);
+		}
+
+		stages.push_back(stage);
+		in = stage.output_queue;
+	}
+}
+
+Pipeline::~Pipeline() {
+	for (size_t i = 0; i < stages.size(); i++) {
+		for (size_t j = 0; j < stages[i].threads.size(); j++)
+			delete stages[i].threads[j];
+		delete stages[i].controller;
+		destroy_queue(stages[i].output_queue);
+	}
+}
+
+void Pipeline::start() {
+	for (size_t i = 0; i < stages.size(); i++) {
+		for (size_t j = 0; j < stages[i].threads.size(); j++) {
+			stages[i].threads[j]->start();
+			pin_thread(stages[i].threads[j], stages[i].cpus, j);
+		}
+		if (stages[i].controller)
+			stages[i].controller->start();
+	}
+}
+
+void Pipeline::join() {
+	for (size_t i = 0; i < stages.size(); i++) {
+		for (size_t j = 0; j < stages[i].threads.size(); j++)
+			stages[i].threads[j]->join();
+		if (stages[i].controller)
+			stages[i].controller->join();
+		stages[i].output_queue->close();
+	}
+}
+
+int Pipeline::get_num_stages() {
+	return stages.size();
+}
+
+Queue<Item*>* Pipeline::get_queue(int stage) {
+	return stages[stage].output_queue;
+}
+
+std::string Pipeline::get_queue_name(int stage) {
+	if (stage + 1 == (int)stages.size())
+		return "output";
+	return "worker" + std::to_string(stage + 1);
+}
+
+Queue<Item*>* Pipeline::get_output_queue() {
+	return stages.back().output_queue;
+}
+
+#endif // PIPELINE_HPP
@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+
+#ifndef PIPELINE_MONITOR_HPP
+#define PIPELINE_MONITOR_HPP
+
+// the default interval between two queue occupancy samples, in microseconds
+#define PIPELINE_MONITOR_SAMPLE_PERIOD 10000
+
+// Measurements for benchmarking. The Reader stamps every item as it
+// enters the pipeline and the Writer records the time since the stamp
+// when the item leaves it; a sampler thread records the size of each
+// queue every sample_period. Both are written out at the end of the run:
+// a JSON summary (throughput and latency percentiles) and a CSV of the
+// occupancy over time.
+class PipelineMonitor : public Thread {
+public:
+	// constructor
+	explicit PipelineMonitor(int sample_period = PIPELINE_MONITOR_SAMPLE_PERIOD);
+
+	// destructor
+	~PipelineMonitor();
+
+	// a queue to sample, in pipeline order, before start()
+	void add_queue(const std::string& name, Queue<Item*>* queue);
+
+	// starts the clock and the sampler thread
+	virtual void start() override;
+
+	// stops the clock and joins the sampler thread
+	void stop();
+
+	// Reader side: marks the item as entering the pipeline now
+	void stamp(Item* item);
+
+	// Writer side (a single thread): the item has been written
+	void record(const Item* item);
+
+	// write {"items", "seconds", "items_per_second", "latency_us": {...}}
+	bool write_report(std::string file);
+
+	// write a "time,<queue name>,..." header, then one row per sample
+	bool write_occupancy(std::string file);
+private:
+	struct Sample {
+		double time;
+		// the size of every queue, in the order they were added
+		std::vector<int> sizes;
+	};
+
+	std::vector<std::string> queue_names;
+	std::vector<Queue<Item*>*> queues;
+	int sample_period;
+
+	long long start_time;
+	long long stop_time;
+	std::atomic<bool> stopping;
+
+	// written by the Writer only, read after stop()
+	std::vector<long long> latencies;
+	// written by the sampler only, read after stop()
+	std::vector<Sample> samples;
+
+	static long long now();
+
+	// the latency at quantile q of the sorted latencies, in microseconds
+	double percentile(const std::vector<long long>& sorted, double q);
+
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+PipelineMonitor::PipelineMonitor(int sample_period) : sample_period(sample_period) {
+	start_time = stop_time = 0;
+	stopping.store(false);
+}
+
+PipelineMonitor::~PipelineMonitor() {}
+
+void PipelineMonitor::add_queue(const std::string& name, Queue<Item*>* queue) {
+	queue_names.push_back(name);
+	queues.push_back(queue);
+}
+
+long long PipelineMonitor::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void PipelineMonitor::start() {
+	start_time = now();
+	pthread_create(&t, 0, PipelineMonitor::process, (void*)this);
+}
+
+void PipelineMonitor::stop() {
+	stop_time = now();
+	stopping.store(true, std::memory_order_release);
+	join();
+}
+
+void PipelineMonitor::stamp(Item* item) {
+	item->timestamp = now();
+}
+
+void PipelineMonitor::record(const Item* item) {
+	latencies.push_back(now() - item->timestamp);
+}
+
+double PipelineMonitor::percentile(const std::vector<long long>& sorted, double q) {
+	if (sorted.empty())
+		return 0;
+
+	// nearest rank
+	size_t rank = (size_t)(q * sorted.size() + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > sorted.size())
+		rank = sorted.size();
+	return sorted[rank - 1] / 1000.0;
+}
+
+bool PipelineMonitor::write_report(std::string file) {
+	std::ofstream ofs(file);
+	if (!ofs)
+		return false;
+
+	std::vector<long long> sorted(latencies);
+	std::sort(sorted.begin(), sorted.end());
+
+	double seconds = (stop_time - start_time) / 1e9;
+
+	ofs << "{\n"
+		<< "\t\"items\": " << sorted.size() << ",\n"
+		<< "\t\"seconds\": " << seconds << ",\n"
+		<< "\t\"items_per_second\": " << (seconds > 0 ? sorted.size() / seconds : 0) << ",\n"
+		<< "\t\"latency_us\": {\n"
+		<< "\t\t\"p50\": " << percentile(sorted, 0.5) << ",\n"
+		<< "\t\t\"p99\": " << percentile(sorted, 0.99) << ",\n"
+		<< "\t\t\"p999\": " << percentile(sorted, 0.999) << ",\n"
+		<< "\t\t\"max\": " << (sorted.empty() ? 0 : sorted.back() / 1000.0) << "\n"
+		<< "\t}\n"
+		<< "}\n";
+
+	return (bool)ofs;
+}
+
+bool PipelineMonitor::write_occupancy(std::string file) {
+	std::ofstream ofs(file);
+	if (!ofs)
+		return false;
+
+	ofs << "time";
+	for (size_t i = 0; i < queue_names.size(); i++)
+		ofs << ',' << queue_names[i];
+	ofs << '\n';
+
+	for (size_t i = 0; i < samples.size(); i++) {
+		const Sample& s = samples[i];
+		ofs << s.time;
+		for (size_t j = 0; j < s.sizes.size(); j++)
+			ofs << ',' << s.sizes[j];
+		ofs << '\n';
+	}
+
+	return (bool)ofs;
+}
+
+void* PipelineMonitor::process(void* arg) {
+	PipelineMonitor* monitor = (PipelineMonitor*)arg;
+
+	while (!monitor->stopping.load(std::memory_order_acquire)) {
+		Sample s;
+		s.time = (now() - monitor->start_time) / 1e9;
+		for (size_t i = 0; i < monitor->queues.size(); i++)
+			s.sizes.push_back(monitor->queues[i]->get_size());
+		monitor->samples.push_back(s);
+
+		usleep(monitor->sample_period);
+	}
+
+	return nullptr;
+}
+
+#endif // PIPELINE_MONITOR_HPP
@@ -1,8 +1,10 @@
 #include <pthread.h>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "transform_batch.hpp"
+#include "stats.hpp"
 
 #ifndef PRODUCER_HPP
 #define PRODUCER_HPP
@@ -10,7 +12,7 @@
 class Producer : public Thread {
 public:
 	// constructor
-	Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transfomrer);
+	Producer(Queue<Item*>* input_queue, Queue<Item*>* worker_queue, Transformer* transfomrer, int batch_size = 1, ThreadStats* stats = nullptr, TransformMany many = &Transformer::producer_transform_many, TransformCache* cache = nullptr);
 
 	// destructor
 	~Producer();
@@ -18,18 +20,30 @@ public:
 	virtual void start();
 
 private:
-	TSQueue<Item*>* input_queue;
-	TSQueue<Item*>* worker_queue;
+	Queue<Item*>* input_queue;
+	Queue<Item*>* worker_queue;
 
 	Transformer* transformer;
 
+	// the maximum number of items moved per queue operation
+	int batch_size;
+
+	// when set, queue waits and transform times are counted here
+	ThreadStats* stats;
+
+	// the transform this stage applies
+	TransformMany many;
+
+	// when set, results are looked up here before transforming
+	TransformCache* cache;
+
 	// the method for pthread to create a producer thread
 	static void* process(void* arg);
 
 };
 
-Producer::Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transformer)
-	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer) {
+Producer::Producer(Queue<Item*>* input_queue, Queue<Item*>* worker_queue, Transformer* transformer, int batch_size, ThreadStats* stats, TransformMany many, TransformCache* cache)
+	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer), batch_size(batch_size), stats(stats), many(many), cache(cache) {
 }
 
 Producer::~Producer() {}
@@ -43,16 +57,29 @@ void* Producer::process(void* arg) {
 	// TODO: implements the Producer's work
 	
 	Producer* producer = (Producer*)arg;
-	Item* item;
+	Item** batch = new Item*[producer->batch_size];
+	ThreadStats* stats = producer->stats;
 
-	while(1) 
+	// runs until the input queue is closed and drained
+	while (1)
 	{
-		item = producer->input_queue->dequeue();
-
-		item->val = producer->transformer->producer_transform(item->opcode, item->val);
-
-		producer->worker_queue->enqueue(item);		
+		unsigned long long start = stats ? stats_now_ns() : 0;
+		int count = producer->input_queue->dequeue_bulk(batch, producer->batch_size);
+		if (stats)
+			ThreadStats::add(stats->input_wait_ns, stats_now_ns() - start);
+		if (count == 0)
+			break;
+
+		transform_batch(producer->transformer, producer->many, batch, count, stats, producer->cache);
+
+		if (stats)
+			start = stats_now_ns();
+		producer->worker_queue->enqueue_bulk(batch, count);
+		if (stats)
+			ThreadStats::add(stats->output_wait_ns, stats_now_ns() - start);
 	}
+
+	delete [] batch;
 	return nullptr;
 }
 
@@ -0,0 +1,119 @@
+#include <time.h>
+#include "spin_wait.hpp"
+
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+// what a queue has seen so far, fields a queue does not track stay 0
+struct QueueStats {
+	unsigned long long enqueued;
+	unsigned long long dequeued;
+	// time threads spent waiting for room / for an element, in ns
+	unsigned long long enqueue_blocked_ns;
+	unsigned long long dequeue_blocked_ns;
+	// the largest number of elements ever held at once
+	int high_water;
+	int capacity;
+};
+
+// the interface shared by every queue implementation of the pipeline,
+// so each stage can pick its own queue without the threads caring
+template <class T>
+class Queue {
+public:
+	// destructor
+	virtual ~Queue() {}
+
+	// add an element to the end of the queue
+	virtual void enqueue(T item) = 0;
+
+	// remove and return the first element of the queue,
+	// must not be called on a closed queue that may be empty
+	virtual T dequeue() = 0;
+
+	// remove the first element into item, blocks until there is one;
+	// returns false once the queue is closed and empty
+	bool dequeue(T& item) {
+		return dequeue_bulk(&item, 1) == 1;
+	}
+
+	// remove the first element into item if there is one, never blocks
+	virtual bool try_dequeue(T& item) = 0;
+
+	// add n elements to the end of the queue, in order,
+	// blocks until all of them are in
+	virtual void enqueue_bulk(T* items, int n) {
+		for (int i = 0; i < n; i++)
+			enqueue(items[i]);
+	}
+
+	// remove up to max elements from the front of the queue into items,
+	// blocks until at least one is available and returns how many were
+	// taken, or 0 once the queue is closed and empty
+	virtual int dequeue_bulk(T* items, int max) = 0;
+
+	// like dequeue_bulk, but also returns 0 when nothing arrived within
+	// timeout_us, so a waiting thread can check other conditions between
+	// tries; by default it polls try_dequeue
+	virtual int dequeue_bulk_timed(T* items, int max, int timeout_us) {
+		if (max <= 0)
+			return 0;
+
+		struct timespec start, now;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		SpinWait spin;
+		while (!try_dequeue(items[0])) {
+			// every enqueue finished before close(), so one more try is final
+			if (is_closed()) {
+				if (try_dequeue(items[0]))
+					break;
+				return 0;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long long elapsed_us = (now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000;
+			if (elapsed_us >= timeout_us)
+				return 0;
+			spin.wait();
+		}
+
+		int count = 1;
+		while (count < max && try_dequeue(items[count]))
+			count++;
+		return count;
+	}
+
+	// mark the end of the stream: no more enqueues may follow, and
+	// dequeuers drain what is left and then stop blocking
+	virtual void close() = 0;
+
+	virtual bool is_closed() = 0;
+
+	// return the number of elements in the queue
+	virtual int get_size() = 0;
+
+	// return the maximum number of elements in the queue
+	virtual int get_buffer_size() = 0;
+
+	// return how many elements have ever been enqueued/dequeued,
+	// the difference between two samples gives the arrival/service rate
+	virtual unsigned long long get_enqueue_count() = 0;
+	virtual unsigned long long get_dequeue_count() = 0;
+
+	// gives the queue a new buffer backed by a memory node, for queues
+	// that own one; only valid before the queue is first used. The queue
+	// object itself (head, tail, lock) stays where it was allocated
+	virtual void place_on_node(int /*node*/) {}
+
+	// a snapshot of the counters, by default only the counts
+	virtual QueueStats get_stats() {
+		QueueStats stats = QueueStats();
+		stats.enqueued = get_enqueue_count();
+		stats.dequeued = get_dequeue_count();
+		stats.capacity = get_buffer_size();
+		return stats;
+	}
+};
+
+#endif // QUEUE_HPP
@@ -0,0 +1,65 @@
+#include <string>
+#include "queue.hpp"
+#include "ts_queue.hpp"
+#include "ring_queue.hpp"
+#include "sharded_queue.hpp"
+
+#ifndef QUEUE_FACTORY_HPP
+#define QUEUE_FACTORY_HPP
+
+enum QueueKind {
+	// mutex + condition variables, blocks waiters
+	QUEUE_TS,
+	// the same queue, but waiters spin and yield before sleeping on a futex
+	QUEUE_TS_SPIN,
+	// lock-free, any number of producers and consumers, spins waiters
+	QUEUE_MPMC_RING,
+	// lock-free, exactly one producer and one consumer thread
+	QUEUE_SPSC_RING,
+	// a lock-free lane per enqueuing thread, dequeuers steal between lanes
+	QUEUE_SHARDED
+};
+
+// "ts", "ts-spin", "mpmc", "spsc" or "sharded", false for any other name
+inline bool parse_queue_kind(const std::string& name, QueueKind& kind) {
+	if (name == "ts")
+		kind = QUEUE_TS;
+	else if (name == "ts-spin")
+		kind = QUEUE_TS_SPIN;
+	else if (name == "mpmc")
+		kind = QUEUE_MPMC_RING;
+	else if (name == "spsc")
+		kind = QUEUE_SPSC_RING;
+	else if (name == "sharded")
+		kind = QUEUE_SHARDED;
+	else
+		return false;
+	return true;
+}
+
+// lanes is only used by QUEUE_SHARDED, one per thread that enqueues;
+// the queue is cache-line aligned and must be released with destroy_queue
+template <class T>
+Queue<T>* make_queue(QueueKind kind, int max_buffer_size, int lanes = 1) {
+	switch (kind) {
+	case QUEUE_TS_SPIN:
+		return aligned_new<TSQueue<T>>(max_buffer_size, TS_QUEUE_WAIT_SPIN);
+	case QUEUE_MPMC_RING:
+		return aligned_new<MPMCRingQueue<T>>(max_buffer_size);
+	case QUEUE_SPSC_RING:
+		return aligned_new<SPSCRingQueue<T>>(max_buffer_size);
+	case QUEUE_SHARDED:
+		return aligned_new<ShardedQueue<T>>(max_buffer_size, lanes);
+	case QUEUE_TS:
+	default:
+		return aligned_new<TSQueue<T>>(max_buffer_size);
+	}
+}
+
+// releases a queue from make_queue, nothing if queue is nullptr
+template <class T>
+void destroy_queue(Queue<T>* queue) {
+	aligned_delete(queue);
+}
+
+#endif // QUEUE_FACTORY_HPP
@@ -1,7 +1,11 @@
 #include <fstream>
+#include <iostream>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
+#include "reorder_window.hpp"
+#include "item_pool.hpp"
+#include "pipeline_monitor.hpp"
 
 #ifndef READER_HPP
 #define READER_HPP
@@ -9,7 +13,7 @@
 class Reader : public Thread {
 public:
 	// constructor
-	Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue);
+	Reader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size = 1, ReorderWindow* window = nullptr, ItemPool* pool = nullptr, PipelineMonitor* monitor = nullptr);
 
 	// destructor
 	~Reader();
@@ -17,11 +21,26 @@ public:
 	virtual void start() override;
 private:
 	// the expected lines to read,
-	// the reader thread finished after input expected lines of item
+	// the reader thread finished after input expected lines of item,
+	// or at the end of the input when it is negative
 	int expected_lines;
 
 	std::ifstream ifs;
-	TSQueue<Item*>* input_queue;
+	// ifs, or std::cin when the input file is "-"
+	std::istream* in;
+	Queue<Item*>* input_queue;
+
+	// the number of items handed to the input queue at once
+	int batch_size;
+
+	// when set, an item is only passed on once the Writer's window has room
+	ReorderWindow* window;
+
+	// when set, items come from this pool instead of new
+	ItemPool* pool;
+
+	// when set, every item is stamped as it enters the pipeline
+	PipelineMonitor* monitor;
 
 	// the method for pthread to create a reader thread
 	static void* process(void* arg);
@@ -29,9 +48,14 @@ private:
 
 // Implementaion start
 
-Reader::Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue)
-	: expected_lines(expected_lines), input_queue(input_queue) {
-	ifs = std::ifstream(input_file);
+Reader::Reader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size, ReorderWindow* window, ItemPool* pool, PipelineMonitor* monitor)
+	: expected_lines(expected_lines), input_queue(input_queue), batch_size(batch_size), window(window), pool(pool), monitor(monitor) {
+	if (input_file == "-") {
+		in = &std::cin;
+	} else {
+		ifs = std::ifstream(input_file);
+		in = &ifs;
+	}
 }
 
 Reader::~Reader() {
@@ -45,12 +69,49 @@ void Reader::start() {
 void* Reader::process(void* arg) {
 	Reader* reader = (Reader*)arg;
 
-	while (reader->expected_lines--) {
-		Item *item = new Item;
-		reader->ifs >> *item;
-		reader->input_queue->enqueue(item);
+	Item** batch = new Item*[reader->batch_size];
+
+	bool eof = false;
+	while (reader->expected_lines != 0 && !eof) {
+		int count = 0;
+		while (count < reader->batch_size && reader->expected_lines != 0) {
+			Item *item;
+			if (reader->pool == nullptr) {
+				item = new Item;
+			} else if ((item = reader->pool->try_acquire()) == nullptr) {
+				// what we hold may be what the Writer waits for to free an item
+				reader->input_queue->enqueue_bulk(batch, count);
+				count = 0;
+				item = reader->pool->acquire();
+			}
+			if (!(*reader->in >> *item)) {
+				if (reader->pool)
+					reader->pool->release(item);
+				else
+					delete item;
+				eof = true;
+				break;
+			}
+
+			// hand over what we hold before waiting, the Writer may need it
+			if (reader->window && !reader->window->try_admit(item->key)) {
+				reader->input_queue->enqueue_bulk(batch, count);
+				count = 0;
+				reader->window->admit(item->key);
+			}
+
+			if (reader->monitor)
+				reader->monitor->stamp(item);
+
+			batch[count++] = item;
+			if (reader->expected_lines > 0)
+				reader->expected_lines--;
+		}
+		reader->input_queue->enqueue_bulk(batch, count);
 	}
 
+	delete [] batch;
+
 	return nullptr;
 }
 
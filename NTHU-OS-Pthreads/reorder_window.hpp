@@ -0,0 +1,128 @@
+#include <pthread.h>
+#include <assert.h>
+#include "item.hpp"
+
+#ifndef REORDER_WINDOW_HPP
+#define REORDER_WINDOW_HPP
+
+#define DEFAULT_REORDER_WINDOW_SIZE 4096
+
+// Lets the Writer emit items in input order. Keys must be consecutive
+// integers in input order (as the generated inputs are). The Reader admits
+// an item only once its key is within window_size of the next key the
+// Writer is waiting for, so at most window_size items are ever in flight
+// and a slow key back-pressures the Reader instead of growing the buffer.
+class ReorderWindow {
+public:
+	// constructor
+	explicit ReorderWindow(int window_size = DEFAULT_REORDER_WINDOW_SIZE);
+
+	// destructor
+	~ReorderWindow();
+
+	// Reader side: blocks until the key fits in the window
+	void admit(int key);
+
+	// Reader side: admits the key if it fits, never blocks
+	bool try_admit(int key);
+
+	// Writer side: parks an item until every smaller key has been written
+	void insert(Item* item);
+
+	// Writer side: removes and returns the next item in input order,
+	// nullptr when it has not arrived yet
+	Item* pop_ready();
+private:
+	int window_size;
+	// slot key % window_size holds the item with that key
+	Item** slots;
+
+	// the next key the Writer has to emit
+	int next_key;
+	// whether next_key has been set from the first admitted key
+	bool started;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_advance;
+
+	// whether key is admissible, caller holds the mutex
+	bool fits(int key);
+};
+
+// Implementation start
+
+ReorderWindow::ReorderWindow(int window_size) : window_size(window_size) {
+	assert(window_size > 0);
+
+	slots = new Item*[window_size];
+	for (int i = 0; i < window_size; i++)
+		slots[i] = nullptr;
+
+	next_key = 0;
+	started = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_advance, NULL);
+}
+
+ReorderWindow::~ReorderWindow() {
+	delete [] slots;
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_advance);
+}
+
+bool ReorderWindow::fits(int key) {
+	if (!started) {
+		next_key = key;
+		started = true;
+	}
+
+	assert(key >= next_key);
+	return key - next_key < window_size;
+}
+
+void ReorderWindow::admit(int key) {
+	pthread_mutex_lock(&mutex);
+
+	while (!fits(key))
+		pthread_cond_wait(&cond_advance, &mutex);
+
+	pthread_mutex_unlock(&mutex);
+}
+
+bool ReorderWindow::try_admit(int key) {
+	pthread_mutex_lock(&mutex);
+
+	bool ret = fits(key);
+
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+void ReorderWindow::insert(Item* item) {
+	int slot = item->key % window_size;
+	if (slot < 0)
+		slot += window_size;
+
+	assert(slots[slot] == nullptr);
+	slots[slot] = item;
+}
+
+Item* ReorderWindow::pop_ready() {
+	pthread_mutex_lock(&mutex);
+
+	int slot = next_key % window_size;
+	if (slot < 0)
+		slot += window_size;
+
+	Item* item = slots[slot];
+	if (item != nullptr) {
+		slots[slot] = nullptr;
+		next_key++;
+		pthread_cond_signal(&cond_advance);
+	}
+
+	pthread_mutex_unlock(&mutex);
+	return item;
+}
+
+#endif // REORDER_WINDOW_HPP
@@ -0,0 +1,488 @@
+#include <atomic>
+#include <new>
+#include <utility>
+#include <stddef.h>
+#include <stdlib.h>
+#include "queue.hpp"
+#include "spin_wait.hpp"
+#include "numa.hpp"
+
+#ifndef RING_QUEUE_HPP
+#define RING_QUEUE_HPP
+
+#define CACHE_LINE_SIZE 64
+
+// plain new only guarantees 16-byte alignment before C++17, so the rings
+// (and anything else with alignas(CACHE_LINE_SIZE) members) are created
+// here and released with aligned_delete, which may be given a pointer to
+// the object's base class as long as its destructor is virtual
+template <class T, class... Args>
+T* aligned_new(Args&&... args) {
+	size_t align = alignof(T) < sizeof(void*) ? sizeof(void*) : alignof(T);
+	void* p = nullptr;
+	if (posix_memalign(&p, align, sizeof(T)) != 0)
+		throw std::bad_alloc();
+
+	try {
+		return new (p) T(std::forward<Args>(args)...);
+	} catch (...) {
+		free(p);
+		throw;
+	}
+}
+
+template <class T>
+void aligned_delete(T* p) {
+	if (!p)
+		return;
+	p->~T();
+	free(p);
+}
+
+// round up to the next power of two so that index wrapping is a mask
+inline size_t ring_queue_capacity(int max_buffer_size) {
+	size_t capacity = 2;
+	while (capacity < (size_t)max_buffer_size)
+		capacity <<= 1;
+	return capacity;
+}
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's
+// design). Every slot carries a sequence number telling whether it is
+// ready to be written (sequence == pos) or read (sequence == pos + 1),
+// so producers and consumers only contend on their own end's counter.
+template <class T>
+class MPMCRingQueue : public Queue<T> {
+public:
+	// constructor, the capacity is rounded up to a power of two
+	explicit MPMCRingQueue(int max_buffer_size);
+
+	// destructor
+	~MPMCRingQueue();
+
+	// add an element to the end of the queue, spins while the queue is full
+	virtual void enqueue(T item) override;
+
+	// remove and return the first element, spins while the queue is empty
+	virtual T dequeue() override;
+	using Queue<T>::dequeue;
+
+	// takes whatever is ready after the first element, without spinning again
+	virtual int dequeue_bulk(T* items, int max) override;
+
+	virtual void close() override;
+	virtual bool is_closed() override;
+
+	// non-blocking versions, return false when the queue is full/empty
+	bool try_enqueue(T item);
+	virtual bool try_dequeue(T& item) override;
+
+	// return the (approximate) number of elements in the queue
+	virtual int get_size() override;
+
+	virtual int get_buffer_size() override;
+
+	// the head/tail positions never wrap, so they are the counts
+	virtual unsigned long long get_enqueue_count() override;
+	virtual unsigned long long get_dequeue_count() override;
+
+	virtual void place_on_node(int node) override;
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	size_t buffer_size;
+	size_t mask;
+	Cell* buffer;
+
+	// the next position to enqueue/dequeue, each on its own cache line
+	// so producers and consumers do not bounce the same line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	char pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+	// set by close(), read by dequeuers once the queue looks empty
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> closed;
+};
+
+// Bounded lock-free single-producer single-consumer queue. Only valid when
+// exactly one thread enqueues and exactly one thread dequeues; each side
+// caches the other side's index to avoid touching its cache line.
+template <class T>
+class SPSCRingQueue : public Queue<T> {
+public:
+	// constructor, the capacity is rounded up to a power of two
+	explicit SPSCRingQueue(int max_buffer_size);
+
+	// destructor
+	~SPSCRingQueue();
+
+	virtual void enqueue(T item) override;
+
+	virtual T dequeue() override;
+	using Queue<T>::dequeue;
+
+	// publish/consume a whole batch with a single index store
+	virtual void enqueue_bulk(T* items, int n) override;
+
+	virtual int dequeue_bulk(T* items, int max) override;
+
+	virtual void close() override;
+	virtual bool is_closed() override;
+
+	bool try_enqueue(T item);
+	virtual bool try_dequeue(T& item) override;
+
+	virtual int get_size() override;
+
+	virtual int get_buffer_size() override;
+
+	// the head/tail positions never wrap, so they are the counts
+	virtual unsigned long long get_enqueue_count() override;
+	virtual unsigned long long get_dequeue_count() override;
+
+	virtual void place_on_node(int node) override;
+private:
+	size_t buffer_size;
+	size_t mask;
+	T* buffer;
+
+	// producer side: its own index and its last view of the consumer's
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+	size_t head_cache;
+	// consumer side: its own index and its last view of the producer's
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+	size_t tail_cache;
+	char pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> closed;
+};
+
+// Implementation start
+
+template <class T>
+MPMCRingQueue<T>::MPMCRingQueue(int max_buffer_size) {
+	buffer_size = ring_queue_capacity(max_buffer_size);
+	mask = buffer_size - 1;
+	buffer = numa_new_array<Cell>(buffer_size);
+
+	for (size_t i = 0; i < buffer_size; i++)
+		buffer[i].sequence.store(i, std::memory_order_relaxed);
+
+	tail.store(0, std::memory_order_relaxed);
+	head.store(0, std::memory_order_relaxed);
+	closed.store(false, std::memory_order_relaxed);
+}
+
+template <class T>
+MPMCRingQueue<T>::~MPMCRingQueue() {
+	numa_delete_array(buffer, buffer_size);
+}
+
+template <class T>
+bool MPMCRingQueue<T>::try_enqueue(T item) {
+	size_t pos = tail.load(std::memory_order_relaxed);
+
+	while (1) {
+		Cell* cell = &buffer[pos & mask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		long diff = (long)seq - (long)pos;
+
+		if (diff == 0) {
+			// the slot is free, try to claim it
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell->data = item;
+				cell->sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			// the slot still holds an element from the previous lap
+			return false;
+		} else {
+			// another producer claimed the slot, reload
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+bool MPMCRingQueue<T>::try_dequeue(T& item) {
+	size_t pos = head.load(std::memory_order_relaxed);
+
+	while (1) {
+		Cell* cell = &buffer[pos & mask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		long diff = (long)seq - (long)(pos + 1);
+
+		if (diff == 0) {
+			// the slot is filled, try to claim it
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				item = cell->data;
+				cell->sequence.store(pos + mask + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			// the producer of this slot has not finished yet
+			return false;
+		} else {
+			// another consumer claimed the slot, reload
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+void MPMCRingQueue<T>::enqueue(T item) {
+	SpinWait spin;
+	while (!try_enqueue(item))
+		spin.wait();
+}
+
+template <class T>
+T MPMCRingQueue<T>::dequeue() {
+	SpinWait spin;
+	T item;
+	while (!try_dequeue(item))
+		spin.wait();
+	return item;
+}
+
+template <class T>
+int MPMCRingQueue<T>::dequeue_bulk(T* items, int max) {
+	if (max <= 0)
+		return 0;
+
+	SpinWait spin;
+	while (!try_dequeue(items[0])) {
+		// every enqueue finished before close(), so one more try is final
+		if (closed.load(std::memory_order_acquire)) {
+			if (try_dequeue(items[0]))
+				break;
+			return 0;
+		}
+		spin.wait();
+	}
+
+	int count = 1;
+	while (count < max && try_dequeue(items[count]))
+		count++;
+	return count;
+}
+
+template <class T>
+void MPMCRingQueue<T>::close() {
+	closed.store(true, std::memory_order_release);
+}
+
+template <class T>
+bool MPMCRingQueue<T>::is_closed() {
+	return closed.load(std::memory_order_acquire);
+}
+
+template <class T>
+int MPMCRingQueue<T>::get_size() {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t t = tail.load(std::memory_order_relaxed);
+	long size = (long)(t - h);
+
+	if (size < 0)
+		return 0;
+	if (size > (long)buffer_size)
+		return buffer_size;
+	return size;
+}
+
+template <class T>
+int MPMCRingQueue<T>::get_buffer_size() {
+	return buffer_size;
+}
+
+template <class T>
+unsigned long long MPMCRingQueue<T>::get_enqueue_count() {
+	return tail.load(std::memory_order_relaxed);
+}
+
+template <class T>
+unsigned long long MPMCRingQueue<T>::get_dequeue_count() {
+	return head.load(std::memory_order_relaxed);
+}
+
+template <class T>
+void MPMCRingQueue<T>::place_on_node(int node) {
+	// the queue is unused, so a fresh buffer bound before it is written
+	// simply replaces the old one
+	Cell* placed = numa_new_array<Cell>(buffer_size, node);
+	for (size_t i = 0; i < buffer_size; i++)
+		placed[i].sequence.store(i, std::memory_order_relaxed);
+
+	numa_delete_array(buffer, buffer_size);
+	buffer = placed;
+}
+
+template <class T>
+SPSCRingQueue<T>::SPSCRingQueue(int max_buffer_size) {
+	buffer_size = ring_queue_capacity(max_buffer_size);
+	mask = buffer_size - 1;
+	buffer = numa_new_array<T>(buffer_size);
+
+	tail.store(0, std::memory_order_relaxed);
+	head.store(0, std::memory_order_relaxed);
+	head_cache = tail_cache = 0;
+	closed.store(false, std::memory_order_relaxed);
+}
+
+template <class T>
+SPSCRingQueue<T>::~SPSCRingQueue() {
+	numa_delete_array(buffer, buffer_size);
+}
+
+template <class T>
+bool SPSCRingQueue<T>::try_enqueue(T item) {
+	size_t t = tail.load(std::memory_order_relaxed);
+
+	if (t - head_cache == buffer_size) {
+		head_cache = head.load(std::memory_order_acquire);
+		if (t - head_cache == buffer_size)
+			return false;
+	}
+
+	buffer[t & mask] = item;
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+template <class T>
+bool SPSCRingQueue<T>::try_dequeue(T& item) {
+	size_t h = head.load(std::memory_order_relaxed);
+
+	if (h == tail_cache) {
+		tail_cache = tail.load(std::memory_order_acquire);
+		if (h == tail_cache)
+			return false;
+	}
+
+	item = buffer[h & mask];
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+template <class T>
+void SPSCRingQueue<T>::enqueue(T item) {
+	SpinWait spin;
+	while (!try_enqueue(item))
+		spin.wait();
+}
+
+template <class T>
+T SPSCRingQueue<T>::dequeue() {
+	SpinWait spin;
+	T item;
+	while (!try_dequeue(item))
+		spin.wait();
+	return item;
+}
+
+template <class T>
+void SPSCRingQueue<T>::enqueue_bulk(T* items, int n) {
+	SpinWait spin;
+	int done = 0;
+
+	while (done < n) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t space = buffer_size - (t - head_cache);
+
+		if (space == 0) {
+			head_cache = head.load(std::memory_order_acquire);
+			space = buffer_size - (t - head_cache);
+			if (space == 0) {
+				spin.wait();
+				continue;
+			}
+		}
+
+		size_t count = (size_t)(n - done) < space ? (size_t)(n - done) : space;
+		for (size_t i = 0; i < count; i++)
+			buffer[(t + i) & mask] = items[done + i];
+
+		tail.store(t + count, std::memory_order_release);
+		done += count;
+		spin.reset();
+	}
+}
+
+template <class T>
+int SPSCRingQueue<T>::dequeue_bulk(T* items, int max) {
+	if (max <= 0)
+		return 0;
+
+	SpinWait spin;
+	size_t h = head.load(std::memory_order_relaxed);
+
+	while (h == tail_cache) {
+		bool was_closed = closed.load(std::memory_order_acquire);
+		tail_cache = tail.load(std::memory_order_acquire);
+		if (h == tail_cache) {
+			if (was_closed)
+				return 0;
+			spin.wait();
+		}
+	}
+
+	size_t count = tail_cache - h;
+	if (count > (size_t)max)
+		count = max;
+	for (size_t i = 0; i < count; i++)
+		items[i] = buffer[(h + i) & mask];
+
+	head.store(h + count, std::memory_order_release);
+	return count;
+}
+
+template <class T>
+void SPSCRingQueue<T>::close() {
+	closed.store(true, std::memory_order_release);
+}
+
+template <class T>
+bool SPSCRingQueue<T>::is_closed() {
+	return closed.load(std::memory_order_acquire);
+}
+
+template <class T>
+int SPSCRingQueue<T>::get_size() {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t t = tail.load(std::memory_order_relaxed);
+	long size = (long)(t - h);
+
+	if (size < 0)
+		return 0;
+	if (size > (long)buffer_size)
+		return buffer_size;
+	return size;
+}
+
+template <class T>
+int SPSCRingQueue<T>::get_buffer_size() {
+	return buffer_size;
+}
+
+template <class T>
+unsigned long long SPSCRingQueue<T>::get_enqueue_count() {
+	return tail.load(std::memory_order_relaxed);
+}
+
+template <class T>
+unsigned long long SPSCRingQueue<T>::get_dequeue_count() {
+	return head.load(std::memory_order_relaxed);
+}
+
+template <class T>
+void SPSCRingQueue<T>::place_on_node(int node) {
+	T* placed = numa_new_array<T>(buffer_size, node);
+	numa_delete_array(buffer, buffer_size);
+	buffer = placed;
+}
+
+#endif // RING_QUEUE_HPP
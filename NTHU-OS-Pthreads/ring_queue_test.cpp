@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string>
+#include "ring_queue.hpp"
+#include "sharded_queue.hpp"
+
+/* Global shared variables */
+Queue<int>* q;
+int num_producer;
+int num_consumer;
+int** result;
+
+void* produce(void* arg) {
+	int tid = *(int*)arg;
+
+	int from = tid * num_consumer;
+	int to = tid * num_consumer + num_consumer;
+	for (int i = from; i < to; i++) {
+		q->enqueue(i);
+	}
+
+	return nullptr;
+}
+
+void* consume(void* arg) {
+	int tid = *(int*)arg;
+
+	for (int i = 0; i < num_producer; i++) {
+		int val = q->dequeue();
+		result[tid][i] = val;
+	}
+
+	return nullptr;
+}
+
+struct Thread {
+	pthread_t t;
+	int id;
+};
+
+// usage: ./ring_queue_test num_producer num_consumer [sharded]
+int main(int argc, char** argv) {
+	assert(argc == 3 || argc == 4);
+
+	num_producer = atoi(argv[1]);
+	num_consumer = atoi(argv[2]);
+
+	// a lane per producer, plus one for the close check below
+	if (argc == 4 && std::string(argv[3]) == "sharded") {
+		q = aligned_new<ShardedQueue<int>>(20, num_producer + 1);
+	} else {
+		// the SPSC ring is only valid with a single thread on each end
+		if (num_producer == 1 && num_consumer == 1)
+			q = aligned_new<SPSCRingQueue<int>>(20);
+		else
+			q = aligned_new<MPMCRingQueue<int>>(20);
+		// the head and tail padding only works from a cache line boundary
+		assert((uintptr_t)q % CACHE_LINE_SIZE == 0);
+	}
+
+	result = new int*[num_consumer];
+	for (int i = 0; i < num_consumer; i++)
+		result[i] = new int[num_producer];
+
+	Thread* producers = new Thread[num_producer];
+	Thread* consumers = new Thread[num_consumer];
+
+	for (int i = 0; i < num_producer; i++) {
+		producers[i].id = i;
+		pthread_create(&producers[i].t, 0, produce, (void*)&producers[i].id);
+	}
+
+	for (int i = 0; i < num_consumer; i++) {
+		consumers[i].id = i;
+		pthread_create(&consumers[i].t, 0, consume, (void*)&consumers[i].id);
+	}
+
+	for (int i = 0; i < num_producer; i++) {
+		pthread_join(producers[i].t, 0);
+	}
+	for (int i = 0; i < num_consumer; i++) {
+		pthread_join(consumers[i].t, 0);
+	}
+
+	// every value must come out exactly once
+	int total = num_producer * num_consumer;
+	int* seen = new int[total]();
+	for (int i = 0; i < num_consumer; i++)
+		for (int j = 0; j < num_producer; j++)
+			seen[result[i][j]]++;
+	for (int i = 0; i < total; i++)
+		assert(seen[i] == 1);
+
+	for (int i = 0; i < num_consumer; i++) {
+		printf("consumer %d:", i);
+		for (int j = 0; j < num_producer; j++)
+			printf(" %d", result[i][j]);
+		printf("\n");
+	}
+
+	// a closed queue still hands out what it holds, then reports the end
+	int val;
+	q->enqueue(1);
+	q->enqueue(2);
+	q->close();
+	assert(q->dequeue(val) && val == 1);
+	assert(q->dequeue(val) && val == 2);
+	assert(!q->dequeue(val));
+	assert(q->dequeue_bulk(&val, 1) == 0);
+
+	aligned_delete(q);
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <math.h>
+#include <string>
+
+#ifndef SCALING_POLICY_HPP
+#define SCALING_POLICY_HPP
+
+// what the ConsumerController observed over the last check period
+struct ScalingSample {
+	// the number of consumers currently running
+	int num_consumers;
+
+	int worker_queue_size;
+	int worker_queue_capacity;
+	int output_queue_size;
+	int output_queue_capacity;
+
+	// items per second entering / leaving the worker queue
+	double arrival_rate;
+	double service_rate;
+
+	// the length of the period in seconds
+	double period;
+};
+
+// decides how many consumers should run, given the latest sample
+class ScalingPolicy {
+public:
+	virtual ~ScalingPolicy() {}
+
+	// return the desired number of consumers, the controller
+	// adds or removes as many as needed to get there
+	virtual int decide(const ScalingSample& sample) = 0;
+};
+
+// The original rule: one more consumer when the worker queue is above
+// high_threshold, one less when it is below low_threshold (keeping one).
+// The first consumer starts as soon as anything is queued, since a
+// bounded input (e.g. an ordered-output window) may never reach the
+// high threshold.
+class ThresholdScalingPolicy : public ScalingPolicy {
+public:
+	ThresholdScalingPolicy(int low_threshold, int high_threshold)
+		: low_threshold(low_threshold), high_threshold(high_threshold) {}
+
+	virtual int decide(const ScalingSample& sample) override;
+private:
+	int low_threshold;
+	int high_threshold;
+};
+
+// the share of the worker queue the PID policy tries to keep filled
+#define PID_SCALING_SETPOINT 0.5
+#define PID_SCALING_KP 4.0
+#define PID_SCALING_KI 1.0
+#define PID_SCALING_KD 0.5
+// weight of the newest rate sample in the moving averages
+#define PID_SCALING_EWMA_ALPHA 0.3
+// how far past the rounding point the target must move before the pool
+// changes, so it does not flip between two neighbouring sizes
+#define PID_SCALING_DEADBAND 0.25
+// the output queue fill above which more consumers cannot help
+#define PID_SCALING_OUTPUT_PRESSURE 0.9
+
+// Feed-forward on the smoothed arrival rate plus a PID correction on the
+// worker queue depth. The feed-forward term is the number of consumers
+// that keeps up with the arrivals at the observed per-consumer service
+// rate; the PID term drains a backlog or releases idle consumers. It may
+// move by up to max_step consumers per decision.
+class PIDScalingPolicy : public ScalingPolicy {
+public:
+	PIDScalingPolicy(int min_consumers, int max_consumers, int max_step);
+
+	virtual int decide(const ScalingSample& sample) override;
+private:
+	int min_consumers;
+	int max_consumers;
+	int max_step;
+
+	// moving averages of the rates, negative until the first sample
+	double arrival_ewma;
+	double per_consumer_ewma;
+
+	double integral;
+	double previous_error;
+};
+
+// builds a policy by name ("threshold" or "pid"), nullptr if unknown
+ScalingPolicy* make_scaling_policy(
+	const std::string& name,
+	int low_threshold,
+	int high_threshold,
+	int max_consumers
+);
+
+// Implementation start
+
+int ThresholdScalingPolicy::decide(const ScalingSample& sample) {
+	if (sample.worker_queue_size > high_threshold)
+		return sample.num_consumers + 1;
+	if (sample.worker_queue_size > 0 && sample.num_consumers == 0)
+		return 1;
+	if (sample.worker_queue_size < low_threshold && sample.num_consumers >= 2)
+		return sample.num_consumers - 1;
+	return sample.num_consumers;
+}
+
+PIDScalingPolicy::PIDScalingPolicy(int min_consumers, int max_consumers, int max_step)
+	: min_consumers(min_consumers), max_consumers(max_consumers), max_step(max_step) {
+	arrival_ewma = per_consumer_ewma = -1;
+	integral = previous_error = 0;
+}
+
+int PIDScalingPolicy::decide(const ScalingSample& sample) {
+	int current = sample.num_consumers;
+	double dt = sample.period > 0 ? sample.period : 1;
+
+	// smooth the rates so a single burst does not swing the pool
+	if (arrival_ewma < 0)
+		arrival_ewma = sample.arrival_rate;
+	else
+		arrival_ewma += PID_SCALING_EWMA_ALPHA * (sample.arrival_rate - arrival_ewma);
+
+	if (current > 0 && sample.service_rate > 0) {
+		double per_consumer = sample.service_rate / current;
+		if (per_consumer_ewma < 0)
+			per_consumer_ewma = per_consumer;
+		else
+			per_consumer_ewma += PID_SCALING_EWMA_ALPHA * (per_consumer - per_consumer_ewma);
+	}
+
+	// feed-forward: enough consumers to match the arrivals
+	double target = current;
+	if (per_consumer_ewma > 0)
+		target = arrival_ewma / per_consumer_ewma;
+
+	// feedback on the depth, normalised to [-setpoint, 1 - setpoint]
+	double error = 0;
+	if (sample.worker_queue_capacity > 0)
+		error = (double)sample.worker_queue_size / sample.worker_queue_capacity - PID_SCALING_SETPOINT;
+
+	integral += error * dt;
+	// anti-windup: never let the integral alone ask for more than the range
+	double limit = max_consumers / PID_SCALING_KI;
+	if (integral > limit)
+		integral = limit;
+	if (integral < -limit)
+		integral = -limit;
+
+	double derivative = (error - previous_error) / dt;
+	previous_error = error;
+
+	target += PID_SCALING_KP * error + PID_SCALING_KI * integral + PID_SCALING_KD * derivative;
+
+	int desired = current;
+	if (fabs(target - current) >= 0.5 + PID_SCALING_DEADBAND)
+		desired = (int)lround(target);
+
+	// a full output queue means the writer is the bottleneck
+	if (sample.output_queue_capacity > 0 &&
+		sample.output_queue_size >= PID_SCALING_OUTPUT_PRESSURE * sample.output_queue_capacity &&
+		desired > current)
+		desired = current;
+
+	// never leave queued work without a consumer
+	if (sample.worker_queue_size > 0 && desired < 1)
+		desired = 1;
+
+	if (desired > current + max_step)
+		desired = current + max_step;
+	if (desired < current - max_step)
+		desired = current - max_step;
+	if (desired > max_consumers)
+		desired = max_consumers;
+	if (desired < min_consumers)
+		desired = min_consumers;
+
+	return desired;
+}
+
+ScalingPolicy* make_scaling_policy(
+	const std::string& name,
+	int low_threshold,
+	int high_threshold,
+	int max_consumers
+) {
+	if (name == "threshold")
+		return new ThresholdScalingPolicy(low_threshold, high_threshold);
+	if (name == "pid")
+		return new PIDScalingPolicy(1, max_consumers, max_consumers / 4 > 1 ? max_consumers / 4 : 1);
+	return nullptr;
+}
+
+#endif // SCALING_POLICY_HPP
@@ -3,60 +3,91 @@
 import click
 import json
 
-def generate_case(opcode, annotation, case_spec):
+def generate_row(annotation, case_spec):
+	template = f'''
+	// {annotation}
+	{{ {case_spec['a']}, {case_spec['b']}, {case_spec['m']}, {case_spec['iterations']} }},'''
+
+	return template
+
+def generate_case(opcode, annotation, table, index):
 	template = f'''
 	// {annotation}
 	case '{opcode}':
-		spec->a = {case_spec['a']};
-		spec->b = {case_spec['b']};
-		spec->m = {case_spec['m']};
-		spec->iterations = {case_spec['iterations']};
-		break;
+		return transform<{table}, {index}>(val);
 '''
 	
 	return template
 
+def generate_many_case(opcode, annotation, table, index):
+	template = f'''
+	// {annotation}
+	case '{opcode}':
+		transform_many<{table}, {index}>(vals, n);
+		return;
+'''
+
+	return template
+
 def generate_cpp(spec):
+	producer_table = ''
 	producer_spec = ''
-	for opcode in spec['annotation']:
-		producer_spec += generate_case(opcode, spec['annotation'][opcode], spec['producer'][opcode])
+	producer_many = ''
+	for index, opcode in enumerate(spec['annotation']):
+		producer_table += generate_row(spec['annotation'][opcode], spec['producer'][opcode])
+		producer_spec += generate_case(opcode, spec['annotation'][opcode], 'producer_specs', index)
+		producer_many += generate_many_case(opcode, spec['annotation'][opcode], 'producer_specs', index)
 
+	consumer_table = ''
 	consumer_spec = ''
-	for opcode in spec['annotation']:
-		consumer_spec += generate_case(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
+	consumer_many = ''
+	for index, opcode in enumerate(spec['annotation']):
+		consumer_table += generate_row(spec['annotation'][opcode], spec['consumer'][opcode])
+		consumer_spec += generate_case(opcode, spec['annotation'][opcode], 'consumer_specs', index)
+		consumer_many += generate_many_case(opcode, spec['annotation'][opcode], 'consumer_specs', index)
 
 	template = f'''// CODEGEN BY auto_gen_transformer.py; DO NOT EDIT.
 
 #include <assert.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+// one row per opcode, in the order of the switches below
+static constexpr TransformSpec producer_specs[] = {{{producer_table}
+}};
+
+static constexpr TransformSpec consumer_specs[] = {{{consumer_table}
+}};
 
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
 	switch (opcode) {{{producer_spec}
 	default:
 		assert(false);
 	}}
 
-	return transform(spec, val);
+	return val;
 }}
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
-
 	switch (opcode) {{{consumer_spec}
 	default:
 		assert(false);
 	}}
 
-	return transform(spec, val);
+	return val;
+}}
+
+void Transformer::producer_transform_many(char opcode, unsigned long long* vals, int n) {{
+	switch (opcode) {{{producer_many}
+	default:
+		assert(false);
+	}}
 }}
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {{
-	while (spec->iterations--) {{
-		val = (val * spec->a + spec->b) % spec->m;
+void Transformer::consumer_transform_many(char opcode, unsigned long long* vals, int n) {{
+	switch (opcode) {{{consumer_many}
+	default:
+		assert(false);
 	}}
-  return val;
 }}
 '''
 
@@ -81,4 +112,3 @@ def generate(input, output):
 
 if __name__ == '__main__':
 	generate()
-
@@ -0,0 +1,137 @@
+import click
+import csv
+import itertools
+import json
+import os
+import subprocess
+import sys
+
+FIELDS = [
+	'n', 'mix', 'reader_queue_size', 'worker_queue_size', 'writer_queue_size',
+	'producers', 'check_period', 'scaling_policy', 'run',
+	'items', 'seconds', 'items_per_second', 'p50_us', 'p99_us', 'p999_us', 'max_us',
+	'occupancy',
+]
+
+def run(args):
+	print('\033[1;34;48m' + ' '.join(args) + '\033[1;37;0m')
+	subprocess.run(args, check=True, stdout=subprocess.DEVNULL)
+
+def generate_input(spec, n, mix, out_dir):
+	# every line picks uniformly among the opcodes of the mix
+	spec = json.loads(json.dumps(spec))
+	spec['n'] = n
+	spec['auto_gen_input']['choices'] = {str(n): list(mix)}
+
+	spec_path = os.path.join(out_dir, f'{n}_{mix}_spec.json')
+	input_path = os.path.join(out_dir, f'{n}_{mix}.in')
+	with open(spec_path, 'w') as f:
+		json.dump(spec, f, indent='\t')
+
+	if not os.path.exists(input_path):
+		run([sys.executable, 'scripts/auto_gen_input.py', '--input', spec_path, '--output', input_path])
+
+	return input_path
+
+def build(spec_path, out_dir, cxxflags):
+	# the transformer is generated into out_dir so the tree stays untouched
+	transformer = os.path.join(out_dir, 'transformer.cpp')
+	binary = os.path.join(out_dir, 'main')
+	run([sys.executable, 'scripts/auto_gen_transformer.py', '--input', spec_path, '--output', transformer])
+	run(['g++', '-o', binary, '-static', '-std=c++11', '-O3', '-pthread', '-I.'] + cxxflags.split() + ['main.cpp', transformer])
+	return binary
+
+def parse_list(value, convert=str):
+	return [convert(v) for v in value.split(',') if v]
+
+@click.command()
+@click.option('--spec', default='./tests/01_spec.json', help='Spec whose transformer and value range are used.')
+@click.option('--sizes', default='20000', help='Comma separated input sizes.')
+@click.option('--mixes', default='ABCDE', help='Comma separated opcode mixes, e.g. CD,BE.')
+@click.option('--queue-sizes', default='200:200:4000,50:50:1000,1000:1000:8000', help='Comma separated reader:worker:writer queue sizes.')
+@click.option('--producers', default='4', help='Comma separated producer counts.')
+@click.option('--check-periods', default='1000000,100000', help='Comma separated controller periods in microseconds.')
+@click.option('--policies', default='threshold,pid', help='Comma separated scaling policies.')
+@click.option('--repeat', default=1, help='Runs per configuration.')
+@click.option('--cxxflags', default='', help='Extra flags for building main, e.g. -DITEM_BATCH_SIZE=16.')
+@click.option('--out-dir', default='./bench', help='Directory for inputs, binaries and results.')
+def bench(spec, sizes, mixes, queue_sizes, producers, check_periods, policies, repeat, cxxflags, out_dir):
+	os.makedirs(out_dir, exist_ok=True)
+
+	with open(spec, 'r') as jsonf:
+		base_spec = json.load(jsonf)
+
+	spec_path = os.path.join(out_dir, 'transformer_spec.json')
+	with open(spec_path, 'w') as f:
+		json.dump(base_spec, f, indent='\t')
+	binary = build(spec_path, out_dir, cxxflags)
+
+	rows = []
+	grid = itertools.product(
+		parse_list(sizes, int),
+		parse_list(mixes),
+		parse_list(queue_sizes),
+		parse_list(producers, int),
+		parse_list(check_periods, int),
+		parse_list(policies),
+		range(repeat),
+	)
+
+	for n, mix, queues, num_producers, period, policy, i in grid:
+		input_path = generate_input(base_spec, n, mix, out_dir)
+		reader_size, worker_size, writer_size = queues.split(':')
+
+		name = f'{n}_{mix}_{reader_size}-{worker_size}-{writer_size}_p{num_producers}_c{period}_{policy}_{i}'
+		output_path = os.path.join(out_dir, name + '.out')
+		report_path = os.path.join(out_dir, name + '.json')
+		occupancy_path = os.path.join(out_dir, name + '.occupancy.csv')
+
+		run([
+			binary, str(n), input_path, output_path,
+			f'--reader-queue-size={reader_size}',
+			f'--worker-queue-size={worker_size}',
+			f'--writer-queue-size={writer_size}',
+			f'--producers={num_producers}',
+			f'--check-period={period}',
+			f'--scaling-policy={policy}',
+			f'--report={report_path}',
+			f'--occupancy={occupancy_path}',
+		])
+		os.remove(output_path)
+
+		with open(report_path, 'r') as f:
+			report = json.load(f)
+
+		rows.append({
+			'n': n,
+			'mix': mix,
+			'reader_queue_size': int(reader_size),
+			'worker_queue_size': int(worker_size),
+			'writer_queue_size': int(writer_size),
+			'producers': num_producers,
+			'check_period': period,
+			'scaling_policy': policy,
+			'run': i,
+			'items': report['items'],
+			'seconds': report['seconds'],
+			'items_per_second': report['items_per_second'],
+			'p50_us': report['latency_us']['p50'],
+			'p99_us': report['latency_us']['p99'],
+			'p999_us': report['latency_us']['p999'],
+			'max_us': report['latency_us']['max'],
+			'occupancy': occupancy_path,
+		})
+		print(f"{name}: {report['items_per_second']:.0f} items/s, p99 {report['latency_us']['p99']:.0f} us")
+
+	with open(os.path.join(out_dir, 'results.csv'), 'w', newline='') as f:
+		writer = csv.DictWriter(f, fieldnames=FIELDS)
+		writer.writeheader()
+		writer.writerows(rows)
+
+	with open(os.path.join(out_dir, 'results.json'), 'w') as f:
+		json.dump(rows, f, indent='\t')
+
+	print('\n\033[1;32;48m' + f'done: [{out_dir}/results.csv, {out_dir}/results.json].' + '\033[1;37;0m')
+
+if __name__ == '__main__':
+	bench()
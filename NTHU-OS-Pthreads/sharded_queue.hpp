@@ -0,0 +1,252 @@
+#include <atomic>
+#include <time.h>
+#include "queue.hpp"
+#include "ring_queue.hpp"
+#include "spin_wait.hpp"
+
+#ifndef SHARDED_QUEUE_HPP
+#define SHARDED_QUEUE_HPP
+
+// A queue split into lanes, each a lock-free MPMC ring. A thread that
+// enqueues is given its own lane the first time it does so (round-robin,
+// so producers share lanes only when there are more of them than lanes),
+// and a thread that dequeues is given a home lane the same way. Dequeuers
+// take from their home lane and steal from the others when it is empty,
+// so there is no single point every thread contends on. The order is
+// only kept per lane. get_size() is the aggregate depth of every lane,
+// which is what a ConsumerController scales on.
+template <class T>
+class ShardedQueue : public Queue<T> {
+public:
+	// constructor, the capacity is split evenly between the lanes
+	ShardedQueue(int max_buffer_size, int lanes);
+
+	// destructor
+	~ShardedQueue();
+
+	// add an element to the end of the caller's lane, spins while it is full
+	virtual void enqueue(T item) override;
+
+	// remove and return an element, spins while every lane is empty
+	virtual T dequeue() override;
+	using Queue<T>::dequeue;
+
+	virtual bool try_dequeue(T& item) override;
+
+	// takes up to max elements from the home lane, then from the others
+	virtual int dequeue_bulk(T* items, int max) override;
+
+	virtual int dequeue_bulk_timed(T* items, int max, int timeout_us) override;
+
+	virtual void close() override;
+	virtual bool is_closed() override;
+
+	// the sums over every lane
+	virtual int get_size() override;
+	virtual int get_buffer_size() override;
+	virtual unsigned long long get_enqueue_count() override;
+	virtual unsigned long long get_dequeue_count() override;
+
+	virtual void place_on_node(int node) override;
+
+	int get_num_lanes();
+private:
+	int num_lanes;
+	MPMCRingQueue<T>** lanes;
+
+	// the next lane handed to a new enqueuer/dequeuer
+	std::atomic<int> next_enqueue_lane;
+	std::atomic<int> next_dequeue_lane;
+
+	std::atomic<bool> closed;
+
+	// the lane of the calling thread; every thread remembers its lane for
+	// the last sharded queue it enqueued to and dequeued from, which is
+	// all a pipeline thread uses
+	int enqueue_lane();
+	int dequeue_lane();
+
+	// takes up to max elements without waiting, home lane first
+	int take(T* items, int max);
+};
+
+// Implementation start
+
+// the queue and lane a thread last used on each side
+struct ShardedQueueLaneCache {
+	const void* queue;
+	int lane;
+};
+
+static thread_local ShardedQueueLaneCache sharded_queue_enqueue_cache = { nullptr, 0 };
+static thread_local ShardedQueueLaneCache sharded_queue_dequeue_cache = { nullptr, 0 };
+
+template <class T>
+ShardedQueue<T>::ShardedQueue(int max_buffer_size, int lanes) {
+	num_lanes = lanes > 0 ? lanes : 1;
+	int lane_size = (max_buffer_size + num_lanes - 1) / num_lanes;
+
+	this->lanes = new MPMCRingQueue<T>*[num_lanes];
+	for (int i = 0; i < num_lanes; i++)
+		this->lanes[i] = aligned_new<MPMCRingQueue<T>>(lane_size);
+
+	next_enqueue_lane.store(0);
+	next_dequeue_lane.store(0);
+	closed.store(false);
+}
+
+template <class T>
+ShardedQueue<T>::~ShardedQueue() {
+	for (int i = 0; i < num_lanes; i++)
+		aligned_delete(lanes[i]);
+	delete [] lanes;
+}
+
+template <class T>
+int ShardedQueue<T>::enqueue_lane() {
+	ShardedQueueLaneCache& cache = sharded_queue_enqueue_cache;
+	if (cache.queue != this) {
+		cache.queue = this;
+		cache.lane = next_enqueue_lane.fetch_add(1, std::memory_order_relaxed);
+	}
+	return cache.lane % num_lanes;
+}
+
+template <class T>
+int ShardedQueue<T>::dequeue_lane() {
+	ShardedQueueLaneCache& cache = sharded_queue_dequeue_cache;
+	if (cache.queue != this) {
+		cache.queue = this;
+		cache.lane = next_dequeue_lane.fetch_add(1, std::memory_order_relaxed);
+	}
+	return cache.lane % num_lanes;
+}
+
+template <class T>
+int ShardedQueue<T>::take(T* items, int max) {
+	int home = dequeue_lane();
+	int count = 0;
+
+	for (int i = 0; i < num_lanes && count < max; i++) {
+		MPMCRingQueue<T>* lane = lanes[(home + i) % num_lanes];
+		while (count < max && lane->try_dequeue(items[count]))
+			count++;
+	}
+
+	return count;
+}
+
+template <class T>
+void ShardedQueue<T>::enqueue(T item) {
+	lanes[enqueue_lane()]->enqueue(item);
+}
+
+template <class T>
+T ShardedQueue<T>::dequeue() {
+	T item;
+	SpinWait spin;
+	while (take(&item, 1) == 0)
+		spin.wait();
+	return item;
+}
+
+template <class T>
+bool ShardedQueue<T>::try_dequeue(T& item) {
+	return take(&item, 1) == 1;
+}
+
+template <class T>
+int ShardedQueue<T>::dequeue_bulk(T* items, int max) {
+	if (max <= 0)
+		return 0;
+
+	SpinWait spin;
+	int count;
+	while ((count = take(items, max)) == 0) {
+		// every enqueue finished before close(), so one more scan is final
+		if (closed.load(std::memory_order_acquire))
+			return take(items, max);
+		spin.wait();
+	}
+	return count;
+}
+
+template <class T>
+int ShardedQueue<T>::dequeue_bulk_timed(T* items, int max, int timeout_us) {
+	if (max <= 0)
+		return 0;
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	SpinWait spin;
+	int count;
+	while ((count = take(items, max)) == 0) {
+		if (closed.load(std::memory_order_acquire))
+			return take(items, max);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long elapsed_us = (now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000;
+		if (elapsed_us >= timeout_us)
+			return 0;
+		spin.wait();
+	}
+	return count;
+}
+
+template <class T>
+void ShardedQueue<T>::close() {
+	for (int i = 0; i < num_lanes; i++)
+		lanes[i]->close();
+	closed.store(true, std::memory_order_release);
+}
+
+template <class T>
+bool ShardedQueue<T>::is_closed() {
+	return closed.load(std::memory_order_acquire);
+}
+
+template <class T>
+int ShardedQueue<T>::get_size() {
+	int size = 0;
+	for (int i = 0; i < num_lanes; i++)
+		size += lanes[i]->get_size();
+	return size;
+}
+
+template <class T>
+int ShardedQueue<T>::get_buffer_size() {
+	int size = 0;
+	for (int i = 0; i < num_lanes; i++)
+		size += lanes[i]->get_buffer_size();
+	return size;
+}
+
+template <class T>
+unsigned long long ShardedQueue<T>::get_enqueue_count() {
+	unsigned long long count = 0;
+	for (int i = 0; i < num_lanes; i++)
+		count += lanes[i]->get_enqueue_count();
+	return count;
+}
+
+template <class T>
+unsigned long long ShardedQueue<T>::get_dequeue_count() {
+	unsigned long long count = 0;
+	for (int i = 0; i < num_lanes; i++)
+		count += lanes[i]->get_dequeue_count();
+	return count;
+}
+
+template <class T>
+void ShardedQueue<T>::place_on_node(int node) {
+	for (int i = 0; i < num_lanes; i++)
+		lanes[i]->place_on_node(node);
+}
+
+template <class T>
+int ShardedQueue<T>::get_num_lanes() {
+	return num_lanes;
+}
+
+#endif // SHARDED_QUEUE_HPP
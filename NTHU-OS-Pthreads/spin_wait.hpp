@@ -0,0 +1,41 @@
+#include <sched.h>
+
+#ifndef SPIN_WAIT_HPP
+#define SPIN_WAIT_HPP
+
+// busy-wait rounds before a waiter starts yielding the cpu
+#define SPIN_WAIT_SPIN_LIMIT 64
+
+// tells the cpu we are in a spin loop (saves power and avoids
+// a memory-order pipeline flush when the loop exits)
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+// exponential spin then yield, used by the lock-free queues while
+// they wait for a slot or an element to become available
+class SpinWait {
+public:
+	SpinWait() : count(0) {}
+
+	void wait() {
+		if (count < SPIN_WAIT_SPIN_LIMIT) {
+			for (int i = 0; i <= count; i++)
+				cpu_relax();
+			count = count * 2 + 1;
+		} else {
+			sched_yield();
+		}
+	}
+
+	void reset() { count = 0; }
+
+private:
+	int count;
+};
+
+#endif // SPIN_WAIT_HPP
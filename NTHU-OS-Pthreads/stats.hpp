@@ -0,0 +1,269 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <new>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "ring_queue.hpp"
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+// opcodes are indexed by their (7-bit) character code
+#define STATS_NUM_OPCODES 128
+
+static inline unsigned long long stats_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The counters of one worker thread. Only the owner writes them (a plain
+// load and store, no locked instruction) and each sits on its own cache
+// lines, so counting never contends; readers sum them up on demand.
+struct alignas(CACHE_LINE_SIZE) ThreadStats {
+	ThreadStats();
+
+	// time waiting in dequeue (starved by the stage before) and in
+	// enqueue (held back by the stage after)
+	std::atomic<unsigned long long> input_wait_ns;
+	std::atomic<unsigned long long> output_wait_ns;
+
+	std::atomic<unsigned long long> transform_items[STATS_NUM_OPCODES];
+	std::atomic<unsigned long long> transform_ns[STATS_NUM_OPCODES];
+
+	// owner side
+	static void add(std::atomic<unsigned long long>& counter, unsigned long long delta) {
+		counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	void add_transform(char opcode, int items, unsigned long long ns) {
+		add(transform_items[opcode & (STATS_NUM_OPCODES - 1)], items);
+		add(transform_ns[opcode & (STATS_NUM_OPCODES - 1)], ns);
+	}
+};
+
+// Owns the ThreadStats of every worker (also of the consumers that have
+// been scaled down, so nothing is lost) and knows the queues, grouped by
+// stage name. print() writes one line per queue and per stage.
+class StatsRegistry {
+public:
+	// constructor
+	StatsRegistry();
+
+	// destructor, frees every ThreadStats
+	~StatsRegistry();
+
+	// a zeroed slot for a new thread of the given stage
+	ThreadStats* register_thread(const std::string& stage);
+
+	void add_queue(const std::string& name, Queue<Item*>* queue);
+
+	void print(std::ostream& os);
+private:
+	struct Slot {
+		std::string stage;
+		ThreadStats* stats;
+	};
+
+	struct NamedQueue {
+		std::string name;
+		Queue<Item*>* queue;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<NamedQueue> queues;
+	unsigned long long start_time;
+
+	pthread_mutex_t mutex;
+};
+
+// prints the registry every period microseconds until stopped
+class StatsReporter : public Thread {
+public:
+	StatsReporter(StatsRegistry* registry, int period);
+
+	virtual void start() override;
+
+	// wakes the thread and joins it
+	void stop();
+private:
+	StatsRegistry* registry;
+	int period;
+
+	bool stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_stop;
+
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+ThreadStats::ThreadStats() {
+	input_wait_ns.store(0);
+	output_wait_ns.store(0);
+	for (int i = 0; i < STATS_NUM_OPCODES; i++) {
+		transform_items[i].store(0);
+		transform_ns[i].store(0);
+	}
+}
+
+StatsRegistry::StatsRegistry() {
+	start_time = stats_now_ns();
+	pthread_mutex_init(&mutex, NULL);
+}
+
+StatsRegistry::~StatsRegistry() {
+	for (size_t i = 0; i < slots.size(); i++) {
+		slots[i].stats->~ThreadStats();
+		free(slots[i].stats);
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+ThreadStats* StatsRegistry::register_thread(const std::string& stage) {
+	Slot slot;
+	slot.stage = stage;
+	// plain new only guarantees 16-byte alignment before C++17
+	void* p = nullptr;
+	if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(ThreadStats)) != 0)
+		throw std::bad_alloc();
+	slot.stats = new (p) ThreadStats;
+
+	pthread_mutex_lock(&mutex);
+	slots.push_back(slot);
+	pthread_mutex_unlock(&mutex);
+
+	return slot.stats;
+}
+
+void StatsRegistry::add_queue(const std::string& name, Queue<Item*>* queue) {
+	NamedQueue q;
+	q.name = name;
+	q.queue = queue;
+
+	pthread_mutex_lock(&mutex);
+	queues.push_back(q);
+	pthread_mutex_unlock(&mutex);
+}
+
+void StatsRegistry::print(std::ostream& os) {
+	pthread_mutex_lock(&mutex);
+
+	std::ios::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(3);
+	os << "[stats] t=" << (stats_now_ns() - start_time) / 1e9 << "s\n";
+
+	for (size_t i = 0; i < queues.size(); i++) {
+		QueueStats s = queues[i].queue->get_stats();
+		os << "[stats] queue " << queues[i].name
+			<< ": size " << queues[i].queue->get_size() << "/" << s.capacity
+			<< ", high-water " << s.high_water
+			<< ", in " << s.enqueued << ", out " << s.dequeued
+			<< ", blocked enqueue " << s.enqueue_blocked_ns / 1e9 << "s"
+			<< ", blocked dequeue " << s.dequeue_blocked_ns / 1e9 << "s\n";
+	}
+
+	// sum the slots of every stage, in the order the stages registered
+	std::vector<std::string> stages;
+	for (size_t i = 0; i < slots.size(); i++) {
+		bool seen = false;
+		for (size_t j = 0; j < stages.size(); j++)
+			seen = seen || stages[j] == slots[i].stage;
+		if (!seen)
+			stages.push_back(slots[i].stage);
+	}
+
+	for (size_t k = 0; k < stages.size(); k++) {
+		int threads = 0;
+		unsigned long long input_wait = 0, output_wait = 0;
+		unsigned long long items[STATS_NUM_OPCODES] = {};
+		unsigned long long ns[STATS_NUM_OPCODES] = {};
+
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].stage != stages[k])
+				continue;
+			ThreadStats* s = slots[i].stats;
+			threads++;
+			input_wait += s->input_wait_ns.load(std::memory_order_relaxed);
+			output_wait += s->output_wait_ns.load(std::memory_order_relaxed);
+			for (int c = 0; c < STATS_NUM_OPCODES; c++) {
+				items[c] += s->transform_items[c].load(std::memory_order_relaxed);
+				ns[c] += s->transform_ns[c].load(std::memory_order_relaxed);
+			}
+		}
+
+		os << "[stats] stage " << stages[k] << ": " << threads << " threads"
+			<< ", waiting for input " << input_wait / 1e9 << "s"
+			<< ", for output " << output_wait / 1e9 << "s";
+		for (int c = 0; c < STATS_NUM_OPCODES; c++) {
+			if (items[c] > 0)
+				os << ", " << (char)c << " " << items[c] << " items " << ns[c] / 1e6 << "ms";
+		}
+		os << "\n";
+	}
+
+	os.flags(flags);
+	os.flush();
+
+	pthread_mutex_unlock(&mutex);
+}
+
+StatsReporter::StatsReporter(StatsRegistry* registry, int period)
+	: registry(registry), period(period) {
+	stopping = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_stop, NULL);
+}
+
+void StatsReporter::start() {
+	pthread_create(&t, 0, StatsReporter::process, (void*)this);
+}
+
+void StatsReporter::stop() {
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_signal(&cond_stop);
+	pthread_mutex_unlock(&mutex);
+
+	join();
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_stop);
+}
+
+void* StatsReporter::process(void* arg) {
+	StatsReporter* reporter = (StatsReporter*)arg;
+
+	pthread_mutex_lock(&reporter->mutex);
+	while (!reporter->stopping) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += reporter->period / 1000000;
+		deadline.tv_nsec += (reporter->period % 1000000) * 1000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		// the dump runs only after a full period without a stop
+		if (pthread_cond_timedwait(&reporter->cond_stop, &reporter->mutex, &deadline) == 0 || reporter->stopping)
+			continue;
+
+		pthread_mutex_unlock(&reporter->mutex);
+		reporter->registry->print(std::cerr);
+		pthread_mutex_lock(&reporter->mutex);
+	}
+	pthread_mutex_unlock(&reporter->mutex);
+
+	return nullptr;
+}
+
+#endif // STATS_HPP
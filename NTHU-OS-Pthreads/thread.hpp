@@ -1,10 +1,13 @@
 #include <pthread.h>
+#include <sched.h>
 
 #ifndef THREAD_HPP
 #define THREAD_HPP
 
 class Thread {
 public:
+	virtual ~Thread() {}
+
 	// to start a new pthread work
 	virtual void start() = 0;
 
@@ -13,6 +16,9 @@ public:
 
 	// to cancel the pthread work
 	virtual int cancel();
+
+	// to pin the started pthread to a set of cpus
+	virtual int set_affinity(const cpu_set_t& cpus);
 protected:
 	pthread_t t;
 };
@@ -25,4 +31,8 @@ int Thread::cancel() {
 	return pthread_cancel(t);
 }
 
+int Thread::set_affinity(const cpu_set_t& cpus) {
+	return pthread_setaffinity_np(t, sizeof(cpu_set_t), &cpus);
+}
+
 #endif // THREAD_HPP
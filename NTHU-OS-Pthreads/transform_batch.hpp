@@ -0,0 +1,83 @@
+#include "item.hpp"
+#include "transformer.hpp"
+#include "stats.hpp"
+#include "transform_cache.hpp"
+
+#ifndef TRANSFORM_BATCH_HPP
+#define TRANSFORM_BATCH_HPP
+
+// the items grouped at once, one bit each in the grouping mask
+#define TRANSFORM_BATCH_GROUP 64
+
+// Transformer::producer_transform_many or consumer_transform_many
+typedef void (Transformer::*TransformMany)(char opcode, unsigned long long* vals, int n);
+
+// Applies one transform stage to a dequeued batch. Items that share an
+// opcode share (a, b, m), so they are gathered into one array, advanced
+// together by transform_many and scattered back. With stats set, the time
+// of every group is added to its opcode. With a cache, the values it holds
+// are taken from it and only the others are transformed (and then added).
+static inline void transform_batch(Transformer* transformer, TransformMany many, Item** batch, int count, ThreadStats* stats = nullptr, TransformCache* cache = nullptr) {
+	Item* group[TRANSFORM_BATCH_GROUP];
+	unsigned long long vals[TRANSFORM_BATCH_GROUP];
+	// the values before the transform, the cache keys of the misses
+	unsigned long long keys[TRANSFORM_BATCH_GROUP];
+	TransformStage stage = many == &Transformer::producer_transform_many ? TRANSFORM_STAGE_PRODUCER : TRANSFORM_STAGE_CONSUMER;
+
+	for (int start = 0; start < count; start += TRANSFORM_BATCH_GROUP) {
+		int size = count - start < TRANSFORM_BATCH_GROUP ? count - start : TRANSFORM_BATCH_GROUP;
+		Item** items = batch + start;
+		unsigned long long done = 0;
+
+		for (int i = 0; i < size; i++) {
+			if (done >> i & 1)
+				continue;
+
+			char opcode = items[i]->opcode;
+			int n = 0;
+			for (int j = i; j < size; j++) {
+				if (!(done >> j & 1) && items[j]->opcode == opcode) {
+					done |= 1ULL << j;
+					group[n] = items[j];
+					vals[n++] = items[j]->val;
+				}
+			}
+
+			if (cache) {
+				// keep only the misses, in place
+				int misses = 0;
+				for (int j = 0; j < n; j++) {
+					unsigned long long result;
+					if (cache->lookup(stage, opcode, vals[j], result)) {
+						group[j]->val = result;
+					} else {
+						group[misses] = group[j];
+						keys[misses] = vals[misses] = vals[j];
+						misses++;
+					}
+				}
+				n = misses;
+				if (n == 0)
+					continue;
+			}
+
+			if (stats) {
+				unsigned long long begin = stats_now_ns();
+				(transformer->*many)(opcode, vals, n);
+				stats->add_transform(opcode, n, stats_now_ns() - begin);
+			} else {
+				(transformer->*many)(opcode, vals, n);
+			}
+
+			for (int j = 0; j < n; j++)
+				group[j]->val = vals[j];
+
+			if (cache) {
+				for (int j = 0; j < n; j++)
+					cache->insert(stage, opcode, keys[j], vals[j]);
+			}
+		}
+	}
+}
+
+#endif // TRANSFORM_BATCH_HPP
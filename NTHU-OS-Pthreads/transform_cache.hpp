@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include "transformer.hpp"
+#include "spin_wait.hpp"
+
+#ifndef TRANSFORM_CACHE_HPP
+#define TRANSFORM_CACHE_HPP
+
+// the entries of one set, scanned on every lookup
+#define TRANSFORM_CACHE_WAYS 8
+
+// the stages a key may belong to
+enum TransformStage {
+	TRANSFORM_STAGE_PRODUCER,
+	TRANSFORM_STAGE_CONSUMER
+};
+
+// Remembers the results of transforms keyed on (stage, opcode, val), for
+// inputs that repeat values. It is set-associative: a key hashes to one
+// set of TRANSFORM_CACHE_WAYS entries, each set has its own spinlock (so
+// threads only contend when they hit the same set) and evicts with the
+// CLOCK algorithm: the hand skips, and clears, entries referenced since
+// it last passed them. The capacity is rounded up to a power of two.
+class TransformCache {
+public:
+	explicit TransformCache(int capacity);
+
+	~TransformCache();
+
+	// the result for the key, false on a miss
+	bool lookup(TransformStage stage, char opcode, unsigned long long val, unsigned long long& result);
+
+	void insert(TransformStage stage, char opcode, unsigned long long val, unsigned long long result);
+
+	unsigned long long get_hits();
+	unsigned long long get_misses();
+	int get_capacity();
+
+	// writes "[stats] transform cache: ..." like the StatsRegistry lines
+	void print(std::ostream& os);
+private:
+	struct Entry {
+		unsigned long long val;
+		unsigned long long result;
+		// stage << 8 | opcode, 0 while the entry is empty
+		unsigned short tag;
+		bool referenced;
+	};
+
+	struct alignas(64) Set {
+		std::atomic_flag lock;
+		unsigned char hand;
+		// counted under the lock, summed on demand
+		unsigned long long hits;
+		unsigned long long misses;
+		Entry entries[TRANSFORM_CACHE_WAYS];
+	};
+
+	int num_sets;
+	Set* sets;
+
+	static unsigned short tag_of(TransformStage stage, char opcode);
+	Set& set_of(unsigned short tag, unsigned long long val);
+
+	static void lock(Set& set);
+	static void unlock(Set& set);
+};
+
+// Implementation start
+
+TransformCache::TransformCache(int capacity) {
+	num_sets = 1;
+	while (num_sets * TRANSFORM_CACHE_WAYS < capacity)
+		num_sets <<= 1;
+
+	// plain new only guarantees 16-byte alignment before C++17
+	void* p = nullptr;
+	if (posix_memalign(&p, alignof(Set), sizeof(Set) * num_sets) != 0)
+		throw std::bad_alloc();
+	sets = (Set*)p;
+
+	for (int i = 0; i < num_sets; i++) {
+		new (&sets[i]) Set;
+		sets[i].lock.clear();
+		sets[i].hand = 0;
+		sets[i].hits = sets[i].misses = 0;
+		for (int j = 0; j < TRANSFORM_CACHE_WAYS; j++) {
+			sets[i].entries[j].tag = 0;
+			sets[i].entries[j].referenced = false;
+		}
+	}
+}
+
+TransformCache::~TransformCache() {
+	free(sets);
+}
+
+unsigned short TransformCache::tag_of(TransformStage stage, char opcode) {
+	// the stage is offset by one so that no real key has tag 0
+	return (unsigned short)((stage + 1) << 8 | (unsigned char)opcode);
+}
+
+TransformCache::Set& TransformCache::set_of(unsigned short tag, unsigned long long val) {
+	// a 64-bit mix (splitmix64's finalizer) so neighbouring values spread out
+	unsigned long long h = val ^ ((unsigned long long)tag << 48);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return sets[h & (num_sets - 1)];
+}
+
+void TransformCache::lock(Set& set) {
+	SpinWait spin;
+	while (set.lock.test_and_set(std::memory_order_acquire))
+		spin.wait();
+}
+
+void TransformCache::unlock(Set& set) {
+	set.lock.clear(std::memory_order_release);
+}
+
+bool TransformCache::lookup(TransformStage stage, char opcode, unsigned long long val, unsigned long long& result) {
+	unsigned short tag = tag_of(stage, opcode);
+	Set& set = set_of(tag, val);
+
+	lock(set);
+	for (int i = 0; i < TRANSFORM_CACHE_WAYS; i++) {
+		Entry& e = set.entries[i];
+		if (e.tag == tag && e.val == val) {
+			e.referenced = true;
+			result = e.result;
+			set.hits++;
+			unlock(set);
+			return true;
+		}
+	}
+	set.misses++;
+	unlock(set);
+
+	return false;
+}
+
+void TransformCache::insert(TransformStage stage, char opcode, unsigned long long val, unsigned long long result) {
+	unsigned short tag = tag_of(stage, opcode);
+	Set& set = set_of(tag, val);
+
+	lock(set);
+
+	// another thread may have inserted it since our miss
+	for (int i = 0; i < TRANSFORM_CACHE_WAYS; i++) {
+		if (set.entries[i].tag == tag && set.entries[i].val == val) {
+			unlock(set);
+			return;
+		}
+	}
+
+	// CLOCK: give every referenced entry a second chance; an empty entry
+	// is never referenced, so it is taken first in hand order
+	while (set.entries[set.hand].referenced) {
+		set.entries[set.hand].referenced = false;
+		set.hand = (set.hand + 1) % TRANSFORM_CACHE_WAYS;
+	}
+
+	Entry& e = set.entries[set.hand];
+	e.tag = tag;
+	e.val = val;
+	e.result = result;
+	e.referenced = false;
+	set.hand = (set.hand + 1) % TRANSFORM_CACHE_WAYS;
+
+	unlock(set);
+}
+
+unsigned long long TransformCache::get_hits() {
+	unsigned long long hits = 0;
+	for (int i = 0; i < num_sets; i++) {
+		lock(sets[i]);
+		hits += sets[i].hits;
+		unlock(sets[i]);
+	}
+	return hits;
+}
+
+unsigned long long TransformCache::get_misses() {
+	unsigned long long misses = 0;
+	for (int i = 0; i < num_sets; i++) {
+		lock(sets[i]);
+		misses += sets[i].misses;
+		unlock(sets[i]);
+	}
+	return misses;
+}
+
+int TransformCache::get_capacity() {
+	return num_sets * TRANSFORM_CACHE_WAYS;
+}
+
+void TransformCache::print(std::ostream& os) {
+	unsigned long long hits = get_hits();
+	unsigned long long misses = get_misses();
+
+	std::ios::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(3);
+	os << "[stats] transform cache: capacity " << get_capacity()
+		<< ", hits " << hits << ", misses " << misses
+		<< ", hit rate " << (hits + misses > 0 ? (double)hits / (hits + misses) : 0) << "\n";
+	os.flags(flags);
+	os.flush();
+}
+
+#endif // TRANSFORM_CACHE_HPP
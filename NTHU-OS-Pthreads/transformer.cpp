@@ -3,111 +3,151 @@
 #include <assert.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
+// one row per opcode, in the order of the switches below
+static constexpr TransformSpec producer_specs[] = {
+	// same speed
+	{ 2003, 183492, 1000000007, 9000000 },
+	// consumer faster than producer
+	{ 2143, 191324, 1000000009, 12000000 },
+	// producer faster than consumer
+	{ 2089, 923134, 1000000021, 5000000 },
+	// producer slightly faster than consumer
+	{ 2677, 912834, 1000000033, 7000000 },
+	// consumer slightly faster than producer
+	{ 2693, 718341, 1000000087, 12000000 },
+};
+
+static constexpr TransformSpec consumer_specs[] = {
+	// same speed
+	{ 2729, 713423, 1000000093, 9000000 },
+	// consumer faster than producer
+	{ 2617, 193424, 1000000097, 5000000 },
+	// producer faster than consumer
+	{ 2053, 743142, 1000000103, 12000000 },
+	// producer slightly faster than consumer
+	{ 2347, 617345, 1000000123, 12000000 },
+	// consumer slightly faster than producer
+	{ 2521, 4719832, 1000000181, 7000000 },
+};
 
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
 	switch (opcode) {
 	// same speed
 	case 'A':
-		spec->a = 2003;
-		spec->b = 183492;
-		spec->m = 1000000007;
-		spec->iterations = 9000000;
-		break;
+		return transform<producer_specs, 0>(val);
 
 	// consumer faster than producer
 	case 'B':
-		spec->a = 2143;
-		spec->b = 191324;
-		spec->m = 1000000009;
-		spec->iterations = 12000000;
-		break;
+		return transform<producer_specs, 1>(val);
 
 	// producer faster than consumer
 	case 'C':
-		spec->a = 2089;
-		spec->b = 923134;
-		spec->m = 1000000021;
-		spec->iterations = 5000000;
-		break;
+		return transform<producer_specs, 2>(val);
 
 	// producer slightly faster than consumer
 	case 'D':
-		spec->a = 2677;
-		spec->b = 912834;
-		spec->m = 1000000033;
-		spec->iterations = 7000000;
-		break;
+		return transform<producer_specs, 3>(val);
 
 	// consumer slightly faster than producer
 	case 'E':
-		spec->a = 2693;
-		spec->b = 718341;
-		spec->m = 1000000087;
-		spec->iterations = 12000000;
-		break;
+		return transform<producer_specs, 4>(val);
 
 	default:
 		assert(false);
 	}
 
-	return transform(spec, val);
+	return val;
 }
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
-
 	switch (opcode) {
 	// same speed
 	case 'A':
-		spec->a = 2729;
-		spec->b = 713423;
-		spec->m = 1000000093;
-		spec->iterations = 9000000;
-		break;
+		return transform<consumer_specs, 0>(val);
 
 	// consumer faster than producer
 	case 'B':
-		spec->a = 2617;
-		spec->b = 193424;
-		spec->m = 1000000097;
-		spec->iterations = 5000000;
-		break;
+		return transform<consumer_specs, 1>(val);
 
 	// producer faster than consumer
 	case 'C':
-		spec->a = 2053;
-		spec->b = 743142;
-		spec->m = 1000000103;
-		spec->iterations = 12000000;
-		break;
+		return transform<consumer_specs, 2>(val);
 
 	// producer slightly faster than consumer
 	case 'D':
-		spec->a = 2347;
-		spec->b = 617345;
-		spec->m = 1000000123;
-		spec->iterations = 12000000;
-		break;
+		return transform<consumer_specs, 3>(val);
 
 	// consumer slightly faster than producer
 	case 'E':
-		spec->a = 2521;
-		spec->b = 4719832;
-		spec->m = 1000000181;
-		spec->iterations = 7000000;
-		break;
+		return transform<consumer_specs, 4>(val);
 
 	default:
 		assert(false);
 	}
 
-	return transform(spec, val);
+	return val;
 }
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {
-	while (spec->iterations--) {
-		val = (val * spec->a + spec->b) % spec->m;
+void Transformer::producer_transform_many(char opcode, unsigned long long* vals, int n) {
+	switch (opcode) {
+	// same speed
+	case 'A':
+		transform_many<producer_specs, 0>(vals, n);
+		return;
+
+	// consumer faster than producer
+	case 'B':
+		transform_many<producer_specs, 1>(vals, n);
+		return;
+
+	// producer faster than consumer
+	case 'C':
+		transform_many<producer_specs, 2>(vals, n);
+		return;
+
+	// producer slightly faster than consumer
+	case 'D':
+		transform_many<producer_specs, 3>(vals, n);
+		return;
+
+	// consumer slightly faster than producer
+	case 'E':
+		transform_many<producer_specs, 4>(vals, n);
+		return;
+
+	default:
+		assert(false);
+	}
+}
+
+void Transformer::consumer_transform_many(char opcode, unsigned long long* vals, int n) {
+	switch (opcode) {
+	// same speed
+	case 'A':
+		transform_many<consumer_specs, 0>(vals, n);
+		return;
+
+	// consumer faster than producer
+	case 'B':
+		transform_many<consumer_specs, 1>(vals, n);
+		return;
+
+	// producer faster than consumer
+	case 'C':
+		transform_many<consumer_specs, 2>(vals, n);
+		return;
+
+	// producer slightly faster than consumer
+	case 'D':
+		transform_many<consumer_specs, 3>(vals, n);
+		return;
+
+	// consumer slightly faster than producer
+	case 'E':
+		transform_many<consumer_specs, 4>(vals, n);
+		return;
+
+	default:
+		assert(false);
 	}
-  return val;
 }
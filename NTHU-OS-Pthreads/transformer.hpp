@@ -9,9 +9,55 @@ struct TransformSpec {
   int iterations;
 };
 
+enum TransformEngine {
+  // the reference: applies val = (val * a + b) % m iterations times
+  TRANSFORM_ITERATIVE,
+  // composes the affine map with itself by repeated squaring,
+  // bit-identical to the reference
+  TRANSFORM_CLOSED_FORM
+};
+
+// the affine map x -> a * x + b (mod m)
+struct AffineMap {
+  unsigned long long a;
+  unsigned long long b;
+};
+
+constexpr unsigned long long mulmod(unsigned long long x, unsigned long long y, unsigned long long m) {
+  return (unsigned long long)((unsigned __int128)x * y % m);
+}
+
+// p o q
+constexpr AffineMap affine_compose(AffineMap p, AffineMap q, unsigned long long m) {
+  return AffineMap{ mulmod(p.a, q.a, m), (unsigned long long)(((unsigned __int128)p.a * q.b + p.b) % m) };
+}
+
+// p composed with itself n times, by repeated squaring
+constexpr AffineMap affine_power(AffineMap p, int n, unsigned long long m) {
+  return n <= 0 ? AffineMap{ 1 % m, 0 }
+    : n % 2 ? affine_compose(p, affine_power(affine_compose(p, p, m), n / 2, m), m)
+    : affine_power(affine_compose(p, p, m), n / 2, m);
+}
+
+// the number of values advanced in lockstep by transform_many, enough
+// independent chains to hide the latency of the multiply and reduction
+#define TRANSFORM_LANES 8
+
+// the reference only matches modular arithmetic while (m - 1) * a + b
+// fits in 64 bits; otherwise the closed form must not be used
+constexpr bool affine_exact(TransformSpec spec) {
+  return spec.a == 0 || spec.m - 1 <= (~0ULL - spec.b) / spec.a;
+}
+
+// whether a * x + b with a, x, b < m fits in 64 bits, so the reduction
+// is a 64-bit remainder by a constant (a multiply-high, not a division)
+constexpr bool affine_fits64(unsigned long long m) {
+  return m <= (1ULL << 32);
+}
+
 class Transformer {
 public:
-  Transformer() {};
+  explicit Transformer(TransformEngine engine = TRANSFORM_ITERATIVE) : engine(engine) {};
   ~Transformer() {};
 
   // the producer's work
@@ -20,8 +66,80 @@ public:
   // the consumer's work
   unsigned long long consumer_transform(char opcode, unsigned long long val);
 
+  // the producer's work on n values that share one opcode, in place;
+  // identical to calling producer_transform on each of them
+  void producer_transform_many(char opcode, unsigned long long* vals, int n);
+
+  // the consumer's work on n values that share one opcode, in place
+  void consumer_transform_many(char opcode, unsigned long long* vals, int n);
+
 private:
-  unsigned long long transform(TransformSpec* spec, unsigned long long val);
+  TransformEngine engine;
+
+  // specialised at compile time on one row of a generated spec table,
+  // so the hot path allocates nothing and divides by a constant
+  template <const TransformSpec* Specs, int Index>
+  unsigned long long transform(unsigned long long val);
+
+  // the same on a whole group, TRANSFORM_LANES values at a time
+  template <const TransformSpec* Specs, int Index>
+  void transform_many(unsigned long long* vals, int n);
 };
 
+// Implementation start
+
+template <const TransformSpec* Specs, int Index>
+unsigned long long Transformer::transform(unsigned long long val) {
+  constexpr TransformSpec spec = Specs[Index];
+  constexpr AffineMap rest = affine_power(AffineMap{ spec.a % spec.m, spec.b % spec.m }, spec.iterations - 1, spec.m);
+
+  if (engine == TRANSFORM_CLOSED_FORM && spec.iterations > 0 && affine_exact(spec)) {
+    // the first step runs on the raw input, exactly like the reference
+    val = (val * spec.a + spec.b) % spec.m;
+    return (unsigned long long)(((unsigned __int128)rest.a * val + rest.b) % spec.m);
+  }
+
+  for (int i = 0; i < spec.iterations; i++) {
+    val = (val * spec.a + spec.b) % spec.m;
+  }
+  return val;
+}
+
+template <const TransformSpec* Specs, int Index>
+void Transformer::transform_many(unsigned long long* vals, int n) {
+  constexpr TransformSpec spec = Specs[Index];
+  constexpr AffineMap rest = affine_power(AffineMap{ spec.a % spec.m, spec.b % spec.m }, spec.iterations - 1, spec.m);
+
+  if (engine == TRANSFORM_CLOSED_FORM && spec.iterations > 0 && affine_exact(spec)) {
+    for (int i = 0; i < n; i++) {
+      unsigned long long val = (vals[i] * spec.a + spec.b) % spec.m;
+      if (affine_fits64(spec.m))
+        vals[i] = (rest.a * val + rest.b) % spec.m;
+      else
+        vals[i] = (unsigned long long)(((unsigned __int128)rest.a * val + rest.b) % spec.m);
+    }
+    return;
+  }
+
+  // the lanes are independent, so their dependency chains overlap
+  // instead of waiting on each other one iteration at a time
+  int i = 0;
+  for (; i + TRANSFORM_LANES <= n; i += TRANSFORM_LANES) {
+    unsigned long long lanes[TRANSFORM_LANES];
+    for (int j = 0; j < TRANSFORM_LANES; j++)
+      lanes[j] = vals[i + j];
+
+    for (int k = 0; k < spec.iterations; k++) {
+      for (int j = 0; j < TRANSFORM_LANES; j++)
+        lanes[j] = (lanes[j] * spec.a + spec.b) % spec.m;
+    }
+
+    for (int j = 0; j < TRANSFORM_LANES; j++)
+      vals[i + j] = lanes[j];
+  }
+
+  for (; i < n; i++)
+    vals[i] = transform<Specs, Index>(vals[i]);
+}
+
 #endif // TRANSFORMER_HPP
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "transformer.hpp"
+#include "transform_batch.hpp"
+
+// the closed-form engine must reproduce the iterative reference exactly
+int main() {
+	Transformer* reference = new Transformer(TRANSFORM_ITERATIVE);
+	Transformer* closed_form = new Transformer(TRANSFORM_CLOSED_FORM);
+
+	const char opcodes[] = { 'A', 'B', 'C', 'D', 'E' };
+	const unsigned long long vals[] = { 0, 1, 123456, 1061109567, 18446744073709551615ULL };
+
+	for (int i = 0; i < 5; i++) {
+		for (int j = 0; j < 5; j++) {
+			char opcode = opcodes[i];
+			unsigned long long val = vals[j];
+
+			unsigned long long p = reference->producer_transform(opcode, val);
+			assert(closed_form->producer_transform(opcode, val) == p);
+
+			unsigned long long c = reference->consumer_transform(opcode, p);
+			assert(closed_form->consumer_transform(opcode, p) == c);
+
+			printf("%c %llu -> %llu -> %llu\n", opcode, val, p, c);
+		}
+	}
+
+	// the batched kernel must match the scalar path, including the tail
+	// that does not fill a whole set of lanes
+	const int n = 2 * TRANSFORM_LANES + 3;
+	for (int i = 0; i < 5; i++) {
+		char opcode = opcodes[i];
+		unsigned long long many[n];
+		unsigned long long many_reference[n];
+
+		for (int j = 0; j < n; j++)
+			many[j] = many_reference[j] = vals[j % 5] + j;
+
+		closed_form->producer_transform_many(opcode, many, n);
+		for (int j = 0; j < n; j++)
+			assert(many[j] == reference->producer_transform(opcode, vals[j % 5] + j));
+
+		reference->consumer_transform_many(opcode, many_reference, n);
+		for (int j = 0; j < n; j++)
+			assert(many_reference[j] == reference->consumer_transform(opcode, vals[j % 5] + j));
+	}
+
+	// a cached batch must match too, on the miss that fills the cache and
+	// on the hit that reads it back; the stages must not share results
+	TransformCache* cache = new TransformCache(64);
+	Item items[2 * n];
+	Item* batch[2 * n];
+	for (int round = 0; round < 2; round++) {
+		for (int j = 0; j < 2 * n; j++) {
+			items[j].opcode = opcodes[j % 5];
+			items[j].val = vals[j % 5];
+			batch[j] = &items[j];
+		}
+		transform_batch(closed_form, &Transformer::producer_transform_many, batch, 2 * n, nullptr, cache);
+		for (int j = 0; j < 2 * n; j++)
+			assert(items[j].val == reference->producer_transform(opcodes[j % 5], vals[j % 5]));
+	}
+	unsigned long long result;
+	assert(!cache->lookup(TRANSFORM_STAGE_CONSUMER, opcodes[0], vals[0], result));
+	assert(cache->get_hits() > 0 && cache->get_misses() > 0);
+
+	// a full set evicts, the cache never grows past its capacity
+	for (int j = 0; j < 1000; j++)
+		cache->insert(TRANSFORM_STAGE_CONSUMER, 'A', j, j);
+	int cached = 0;
+	for (int j = 0; j < 1000; j++)
+		cached += cache->lookup(TRANSFORM_STAGE_CONSUMER, 'A', j, result) && result == (unsigned long long)j;
+	assert(cached > 0 && cached <= cache->get_capacity());
+	delete cache;
+
+	delete closed_form;
+	delete reference;
+
+	return 0;
+}
@@ -1,73 +1,190 @@
 #include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include "queue.hpp"
+#include "spin_wait.hpp"
+#include "numa.hpp"
 
 #ifndef TS_QUEUE_HPP
 #define TS_QUEUE_HPP
 
 #define DEFAULT_BUFFER_SIZE 200
+// SpinWait rounds of TS_QUEUE_WAIT_SPIN before sleeping: the first few
+// spin with pause (doubling each round), the rest yield the cpu
+#define TS_QUEUE_SPIN_ROUNDS 16
+
+enum TSQueueWait {
+	// sleep on a condition variable as soon as the queue is empty/full
+	TS_QUEUE_WAIT_BLOCK,
+	// spin, then yield, without the lock, and only then sleep on a futex;
+	// for runs where the queue is rarely empty (or full) for long and a
+	// wakeup costs more than the work on an item
+	TS_QUEUE_WAIT_SPIN
+};
 
 template <class T>
-class TSQueue {
+class TSQueue : public Queue<T> {
 public:
 	// constructor
 	TSQueue();
 
-	explicit TSQueue(int max_buffer_size);
+	explicit TSQueue(
+		int max_buffer_size,
+		TSQueueWait wait = TS_QUEUE_WAIT_BLOCK,
+		int spin_rounds = TS_QUEUE_SPIN_ROUNDS
+	);
 
 	// destructor
 	~TSQueue();
 
 	// add an element to the end of the queue
-	void enqueue(T item);
+	virtual void enqueue(T item) override;
+
+	// remove and return the first element of the queue,
+	// or T() once the queue is closed and empty
+	virtual T dequeue() override;
+	using Queue<T>::dequeue;
+
+	virtual bool try_dequeue(T& item) override;
+
+	// move many elements per lock hold, waking the other side only
+	// when the queue leaves the empty/full state
+	virtual void enqueue_bulk(T* items, int n) override;
+
+	virtual int dequeue_bulk(T* items, int max) override;
+
+	virtual int dequeue_bulk_timed(T* items, int max, int timeout_us) override;
+
+	// wakes every waiter, dequeuers return what is left and then 0
+	virtual void close() override;
 
-	// remove and return the first element of the queue
-	T dequeue();
+	virtual bool is_closed() override;
 
 	// return the number of elements in the queue
-	int get_size();
+	virtual int get_size() override;
 	//////////////////////
-	int get_buffer_size();
+	virtual int get_buffer_size() override;
 	//////////////////////
+	virtual unsigned long long get_enqueue_count() override;
+	virtual unsigned long long get_dequeue_count() override;
+
+	virtual void place_on_node(int node) override;
+
+	// adds the time spent blocked on each condition and the high-water mark
+	virtual QueueStats get_stats() override;
 private:
 	// the maximum buffer size
 	int buffer_size;
 	// the buffer containing values of the queue
 	T* buffer;
-	// the current size of the buffer
-	int size;
+	// the current size of the buffer, only written under the mutex;
+	// spinning waiters read it without the lock
+	std::atomic<int> size;
 	// the index of first item in the queue
 	int head;
 	// the index of last item in the queue
 	int tail;
+	// the total number of items ever enqueued/dequeued
+	unsigned long long enqueue_count;
+	unsigned long long dequeue_count;
+	// set by close(), nothing is enqueued afterwards
+	std::atomic<bool> closed;
+	// time spent in pthread_cond_wait, only measured when a thread blocks
+	unsigned long long enqueue_blocked_ns;
+	unsigned long long dequeue_blocked_ns;
+	int high_water;
+
+	TSQueueWait wait;
+	int spin_rounds;
+	// threads asleep waiting for an element (enqueue) or a slot (dequeue);
+	// nobody is woken while they are 0
+	int enqueue_waiters;
+	int dequeue_waiters;
+	// the futex words of TS_QUEUE_WAIT_SPIN, bumped on every wakeup so a
+	// waiter that read the old value before unlocking does not sleep
+	std::atomic<int> enqueue_seq;
+	std::atomic<int> dequeue_seq;
 
 	// pthread mutex lock
 	pthread_mutex_t mutex;
 	// pthread conditional variable
 	pthread_cond_t cond_enqueue, cond_dequeue;
+
+	// called and return with the mutex held, once the queue has an
+	// element (or is closed) / a free slot; wait_enqueue also returns at
+	// the deadline (in ts_queue_now_ns time) unless it is 0
+	void wait_enqueue(unsigned long long deadline = 0);
+	void wait_dequeue();
+
+	// dequeue_bulk with an optional deadline
+	int dequeue_bulk_until(T* items, int max, unsigned long long deadline);
+
+	// called with the mutex held, wake one or every sleeping waiter
+	void signal(pthread_cond_t* cond, std::atomic<int>* seq, int waiters, bool all);
 };
 
 // Implementation start
 
+static inline unsigned long long ts_queue_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 template <class T>
 TSQueue<T>::TSQueue() : TSQueue(DEFAULT_BUFFER_SIZE) {
 }
 
+// sleeps while *word == val, at most until the deadline unless it is 0
+static inline void ts_queue_futex_wait(std::atomic<int>* word, int val, unsigned long long deadline = 0) {
+	struct timespec timeout;
+	if (deadline) {
+		unsigned long long now = ts_queue_now_ns();
+		unsigned long long left = deadline > now ? deadline - now : 0;
+		timeout.tv_sec = left / 1000000000ULL;
+		timeout.tv_nsec = left % 1000000000ULL;
+	}
+	syscall(SYS_futex, (int*)word, FUTEX_WAIT_PRIVATE, val, deadline ? &timeout : NULL, NULL, 0);
+}
+
+static inline void ts_queue_futex_wake(std::atomic<int>* word, int n) {
+	syscall(SYS_futex, (int*)word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
 template <class T>
-TSQueue<T>::TSQueue(int buffer_size) : buffer_size(buffer_size) {
+TSQueue<T>::TSQueue(int buffer_size, TSQueueWait wait, int spin_rounds)
+	: buffer_size(buffer_size), wait(wait), spin_rounds(spin_rounds) {
 	// TODO: implements TSQueue constructor
-	buffer = new T[buffer_size];
+	buffer = numa_new_array<T>(buffer_size);
 	
 	size = 0;
 	head = tail = 0;
+	enqueue_count = dequeue_count = 0;
+	closed = false;
+	enqueue_blocked_ns = dequeue_blocked_ns = 0;
+	high_water = 0;
+	enqueue_waiters = dequeue_waiters = 0;
+	enqueue_seq = dequeue_seq = 0;
 	pthread_mutex_init(&mutex, NULL);
-	pthread_cond_init(&cond_enqueue, NULL);
-	pthread_cond_init(&cond_dequeue, NULL);
+
+	// timed waits take their deadline on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond_enqueue, &attr);
+	pthread_cond_init(&cond_dequeue, &attr);
+	pthread_condattr_destroy(&attr);
 }
 
 template <class T>
 TSQueue<T>::~TSQueue() {
 	// TODO: implenents TSQueue destructor
 
-	delete [] buffer;
+	numa_delete_array(buffer, buffer_size);
 	size = 0;
 	head = tail = 0;
 	pthread_mutex_destroy(&mutex);
@@ -79,14 +196,16 @@ void TSQueue<T>::enqueue(T item) {
 
 	pthread_mutex_lock(&mutex);
 
-	while(size == buffer_size)
-		pthread_cond_wait(&cond_dequeue, &mutex);
+	wait_dequeue();
 	
 	buffer[tail] = item;
 	size++;
+	if (size > high_water)
+		high_water = size;
+	enqueue_count++;
 	tail++;
 	tail = ((tail % buffer_size)+buffer_size)%buffer_size;
-	pthread_cond_signal(&cond_enqueue);
+	signal(&cond_enqueue, &enqueue_seq, enqueue_waiters, false);
 	pthread_mutex_unlock(&mutex);
 
 
@@ -97,22 +216,218 @@ T TSQueue<T>::dequeue() {
 	// TODO: dequeues the first element of the queue
 	pthread_mutex_lock(&mutex);
 
-	while(size == 0)
-		pthread_cond_wait(&cond_enqueue, &mutex);
+	wait_enqueue();
+
+	// woken by close() with nothing left, there is no element to take
+	if (size == 0) {
+		pthread_mutex_unlock(&mutex);
+		return T();
+	}
 
 	T ret = buffer[head];
 	//buffer[head].~T();
 	size--;
+	dequeue_count++;
 	head++;
 	head = ((head % buffer_size)+buffer_size)%buffer_size;
 	
-	pthread_cond_signal(&cond_dequeue);
+	signal(&cond_dequeue, &dequeue_seq, dequeue_waiters, false);
 	pthread_mutex_unlock(&(mutex));
 
 
 	return ret;
 }
 
+template <class T>
+bool TSQueue<T>::try_dequeue(T& item) {
+	pthread_mutex_lock(&mutex);
+
+	if (size == 0) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+
+	item = buffer[head];
+	size--;
+	dequeue_count++;
+	head = (head + 1) % buffer_size;
+
+	signal(&cond_dequeue, &dequeue_seq, dequeue_waiters, false);
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+template <class T>
+void TSQueue<T>::enqueue_bulk(T* items, int n) {
+	pthread_mutex_lock(&mutex);
+
+	int done = 0;
+	while (done < n) {
+		wait_dequeue();
+
+		int count = 0;
+		while (done < n && size + count < buffer_size) {
+			buffer[tail] = items[done++];
+			count++;
+			tail = (tail + 1) % buffer_size;
+		}
+		size += count;
+		enqueue_count += count;
+		if (size > high_water)
+			high_water = size;
+
+		signal(&cond_enqueue, &enqueue_seq, enqueue_waiters, true);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+int TSQueue<T>::dequeue_bulk(T* items, int max) {
+	return dequeue_bulk_until(items, max, 0);
+}
+
+template <class T>
+int TSQueue<T>::dequeue_bulk_timed(T* items, int max, int timeout_us) {
+	return dequeue_bulk_until(items, max, ts_queue_now_ns() + timeout_us * 1000ULL);
+}
+
+template <class T>
+int TSQueue<T>::dequeue_bulk_until(T* items, int max, unsigned long long deadline) {
+	if (max <= 0)
+		return 0;
+
+	pthread_mutex_lock(&mutex);
+
+	wait_enqueue(deadline);
+
+	if (size == 0) {
+		pthread_mutex_unlock(&mutex);
+		return 0;
+	}
+
+	int count = 0;
+	while (count < max && count < size) {
+		items[count++] = buffer[head];
+		head = (head + 1) % buffer_size;
+	}
+	size -= count;
+	dequeue_count += count;
+
+	signal(&cond_dequeue, &dequeue_seq, dequeue_waiters, true);
+
+	pthread_mutex_unlock(&mutex);
+
+	return count;
+}
+
+template <class T>
+void TSQueue<T>::close() {
+	pthread_mutex_lock(&mutex);
+
+	closed = true;
+	signal(&cond_enqueue, &enqueue_seq, enqueue_waiters, true);
+	signal(&cond_dequeue, &dequeue_seq, dequeue_waiters, true);
+
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+void TSQueue<T>::wait_enqueue(unsigned long long deadline) {
+	if (size > 0 || closed)
+		return;
+
+	unsigned long long start = ts_queue_now_ns();
+
+	if (wait == TS_QUEUE_WAIT_SPIN) {
+		// most empty states are transient, poll without the lock first
+		pthread_mutex_unlock(&mutex);
+		SpinWait spin;
+		for (int i = 0; i < spin_rounds && size.load(std::memory_order_relaxed) == 0 && !closed.load(std::memory_order_relaxed); i++)
+			spin.wait();
+		pthread_mutex_lock(&mutex);
+	}
+
+	while (size == 0 && !closed) {
+		if (deadline && ts_queue_now_ns() >= deadline)
+			break;
+
+		enqueue_waiters++;
+		if (wait == TS_QUEUE_WAIT_SPIN) {
+			int seq = enqueue_seq.load(std::memory_order_relaxed);
+			pthread_mutex_unlock(&mutex);
+			ts_queue_futex_wait(&enqueue_seq, seq, deadline);
+			pthread_mutex_lock(&mutex);
+		} else if (deadline) {
+			struct timespec ts;
+			ts.tv_sec = deadline / 1000000000ULL;
+			ts.tv_nsec = deadline % 1000000000ULL;
+			pthread_cond_timedwait(&cond_enqueue, &mutex, &ts);
+		} else {
+			pthread_cond_wait(&cond_enqueue, &mutex);
+		}
+		enqueue_waiters--;
+	}
+
+	dequeue_blocked_ns += ts_queue_now_ns() - start;
+}
+
+template <class T>
+void TSQueue<T>::wait_dequeue() {
+	if (size < buffer_size)
+		return;
+
+	unsigned long long start = ts_queue_now_ns();
+
+	if (wait == TS_QUEUE_WAIT_SPIN) {
+		pthread_mutex_unlock(&mutex);
+		SpinWait spin;
+		for (int i = 0; i < spin_rounds && size.load(std::memory_order_relaxed) == buffer_size; i++)
+			spin.wait();
+		pthread_mutex_lock(&mutex);
+	}
+
+	while (size == buffer_size) {
+		dequeue_waiters++;
+		if (wait == TS_QUEUE_WAIT_SPIN) {
+			int seq = dequeue_seq.load(std::memory_order_relaxed);
+			pthread_mutex_unlock(&mutex);
+			ts_queue_futex_wait(&dequeue_seq, seq);
+			pthread_mutex_lock(&mutex);
+		} else {
+			pthread_cond_wait(&cond_dequeue, &mutex);
+		}
+		dequeue_waiters--;
+	}
+
+	enqueue_blocked_ns += ts_queue_now_ns() - start;
+}
+
+template <class T>
+void TSQueue<T>::signal(pthread_cond_t* cond, std::atomic<int>* seq, int waiters, bool all) {
+	if (waiters == 0)
+		return;
+
+	if (wait == TS_QUEUE_WAIT_SPIN) {
+		seq->fetch_add(1, std::memory_order_relaxed);
+		ts_queue_futex_wake(seq, all ? INT_MAX : 1);
+	} else if (all) {
+		pthread_cond_broadcast(cond);
+	} else {
+		pthread_cond_signal(cond);
+	}
+}
+
+template <class T>
+bool TSQueue<T>::is_closed() {
+	pthread_mutex_lock(&mutex);
+
+	bool ret = closed;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
 template <class T>
 int TSQueue<T>::get_size() {
 	// TODO: returns the size of the queue
@@ -133,4 +448,45 @@ int TSQueue<T>::get_buffer_size() {
 	return ret;
 }
 
+template <class T>
+unsigned long long TSQueue<T>::get_enqueue_count() {
+	pthread_mutex_lock(&(mutex));
+
+	unsigned long long ret = enqueue_count;
+	pthread_mutex_unlock(&(mutex));
+	return ret;
+}
+
+template <class T>
+unsigned long long TSQueue<T>::get_dequeue_count() {
+	pthread_mutex_lock(&(mutex));
+
+	unsigned long long ret = dequeue_count;
+	pthread_mutex_unlock(&(mutex));
+	return ret;
+}
+
+template <class T>
+void TSQueue<T>::place_on_node(int node) {
+	T* placed = numa_new_array<T>(buffer_size, node);
+	numa_delete_array(buffer, buffer_size);
+	buffer = placed;
+}
+
+template <class T>
+QueueStats TSQueue<T>::get_stats() {
+	pthread_mutex_lock(&mutex);
+
+	QueueStats stats;
+	stats.enqueued = enqueue_count;
+	stats.dequeued = dequeue_count;
+	stats.enqueue_blocked_ns = enqueue_blocked_ns;
+	stats.dequeue_blocked_ns = dequeue_blocked_ns;
+	stats.high_water = high_water;
+	stats.capacity = buffer_size;
+
+	pthread_mutex_unlock(&mutex);
+	return stats;
+}
+
 #endif // TS_QUEUE_HPP
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include <string>
 #include "ts_queue.hpp"
 
 /* Global shared variables */
@@ -38,10 +39,12 @@ struct Thread {
 	int id;
 };
 
+// usage: ./ts_queue_test num_producer num_consumer [block|spin]
 int main(int argc, char** argv) {
-	assert(argc == 3);
+	assert(argc == 3 || argc == 4);
 
-	q = new TSQueue<int>(20);
+	TSQueueWait wait = argc == 4 && std::string(argv[3]) == "spin" ? TS_QUEUE_WAIT_SPIN : TS_QUEUE_WAIT_BLOCK;
+	q = new TSQueue<int>(20, wait);
 	num_producer = atoi(argv[1]);
 	num_consumer = atoi(argv[2]);
 
@@ -76,5 +79,22 @@ int main(int argc, char** argv) {
 		printf("\n");
 	}
 
+	// a closed queue still hands out what it holds, then reports the end
+	int val;
+	// a timed dequeue gives up on an empty queue that is still open
+	assert(q->dequeue_bulk_timed(&val, 1, 1000) == 0);
+
+	q->enqueue(1);
+	q->enqueue(2);
+	q->close();
+	assert(q->dequeue(val) && val == 1);
+	assert(q->dequeue(val) && val == 2);
+	assert(!q->dequeue(val));
+	assert(q->dequeue_bulk(&val, 1) == 0);
+	// and a plain dequeue neither blocks nor moves the counters
+	unsigned long long dequeued = q->get_dequeue_count();
+	assert(q->dequeue() == 0);
+	assert(q->get_size() == 0 && q->get_dequeue_count() == dequeued);
+
 	return 0;
 }
@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+#include "chase_lev_deque.hpp"
+#include "spin_wait.hpp"
+
+#ifndef WORK_STEALING_EXECUTOR_HPP
+#define WORK_STEALING_EXECUTOR_HPP
+
+// the transform stages between the reader and the writer:
+// stage 0 is the producer transform, stage 1 the consumer transform
+#define WORK_STEALING_NUM_STAGES 2
+// rounds of polling the input queue before a worker waits on it
+#define WORK_STEALING_IDLE_ROUNDS 128
+// how long an idle worker waits on the input queue before it looks
+// for tasks to steal again, in us
+#define WORK_STEALING_IDLE_WAIT_US 200
+
+// Runs every transform stage as a task on a fixed set of worker threads,
+// one per cpu, instead of a thread group per stage. Each worker keeps a
+// Chase-Lev deque per stage; when it runs dry it steals from the others,
+// preferring later stages so finished work drains to the writer first.
+class WorkStealingExecutor {
+public:
+	// constructor, num_workers <= 0 means one worker per online cpu
+	WorkStealingExecutor(
+		Queue<Item*>* input_queue,
+		Queue<Item*>* output_queue,
+		Transformer* transformer,
+		int num_workers = 0,
+		int batch_size = 1
+	);
+
+	// destructor
+	~WorkStealingExecutor();
+
+	// starts every worker thread
+	void start();
+
+	// waits for the workers, which stop once the input queue is closed
+	// and drained and every item taken from it reached the output queue
+	void join();
+
+	int get_num_workers();
+private:
+	class Worker : public Thread {
+	public:
+		Worker(WorkStealingExecutor* executor, int id);
+
+		virtual void start() override;
+
+		WorkStealingExecutor* executor;
+		int id;
+		ChaseLevDeque<Item*> deques[WORK_STEALING_NUM_STAGES];
+	private:
+		static void* process(void* arg);
+	};
+
+	Queue<Item*>* input_queue;
+	Queue<Item*>* output_queue;
+
+	Transformer* transformer;
+
+	int num_workers;
+	Worker** workers;
+
+	// the maximum number of items a worker takes from the input queue at once
+	int batch_size;
+
+	// items taken from the input queue but not yet in the output queue
+	std::atomic<long> pending;
+
+	// pops local work or steals it, latest stage first
+	bool find_task(Worker* self, Item*& item, int& stage);
+
+	// applies one stage to the item and passes it on
+	void run_task(Worker* self, Item* item, int stage);
+};
+
+// Implementation start
+
+WorkStealingExecutor::WorkStealingExecutor(
+	Queue<Item*>* input_queue,
+	Queue<Item*>* output_queue,
+	Transformer* transformer,
+	int num_workers,
+	int batch_size
+) : input_queue(input_queue),
+	output_queue(output_queue),
+	transformer(transformer),
+	num_workers(num_workers),
+	batch_size(batch_size) {
+	pending.store(0);
+
+	if (this->num_workers <= 0)
+		this->num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (this->num_workers <= 0)
+		this->num_workers = 1;
+
+	workers = new Worker*[this->num_workers];
+	for (int i = 0; i < this->num_workers; i++)
+		workers[i] = new Worker(this, i);
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+	for (int i = 0; i < num_workers; i++)
+		delete workers[i];
+	delete [] workers;
+}
+
+void WorkStealingExecutor::start() {
+	for (int i = 0; i < num_workers; i++)
+		workers[i]->start();
+}
+
+void WorkStealingExecutor::join() {
+	for (int i = 0; i < num_workers; i++)
+		workers[i]->join();
+}
+
+int WorkStealingExecutor::get_num_workers() {
+	return num_workers;
+}
+
+bool WorkStealingExecutor::find_task(Worker* self, Item*& item, int& stage) {
+	for (stage = WORK_STEALING_NUM_STAGES - 1; stage >= 0; stage--) {
+		if (self->deques[stage].pop(item))
+			return true;
+	}
+
+	for (stage = WORK_STEALING_NUM_STAGES - 1; stage >= 0; stage--) {
+		for (int i = 1; i < num_workers; i++) {
+			Worker* victim = workers[(self->id + i) % num_workers];
+			if (victim->deques[stage].steal(item))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingExecutor::run_task(Worker* self, Item* item, int stage) {
+	if (stage == 0)
+		item->val = transformer->producer_transform(item->opcode, item->val);
+	else
+		item->val = transformer->consumer_transform(item->opcode, item->val);
+
+	if (stage + 1 < WORK_STEALING_NUM_STAGES)
+		self->deques[stage + 1].push(item);
+	else {
+		output_queue->enqueue(item);
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+WorkStealingExecutor::Worker::Worker(WorkStealingExecutor* executor, int id)
+	: executor(executor), id(id) {
+}
+
+void WorkStealingExecutor::Worker::start() {
+	pthread_create(&t, 0, Worker::process, (void*)this);
+}
+
+void* WorkStealingExecutor::Worker::process(void* arg) {
+	Worker* worker = (Worker*)arg;
+	WorkStealingExecutor* executor = worker->executor;
+
+	Item** batch = new Item*[executor->batch_size];
+	SpinWait spin;
+	int idle_rounds = 0;
+
+	while (1) {
+		Item* item;
+		int stage;
+
+		if (executor->find_task(worker, item, stage)) {
+			executor->run_task(worker, item, stage);
+			idle_rounds = 0;
+			spin.reset();
+			continue;
+		}
+
+		// nothing to run or steal, pull fresh items from the reader;
+		// they go to our own deque so idle workers can steal them
+		int count = 0;
+		if (idle_rounds < WORK_STEALING_IDLE_ROUNDS) {
+			while (count < executor->batch_size && executor->input_queue->try_dequeue(batch[count]))
+				count++;
+			if (count == 0) {
+				idle_rounds++;
+				spin.wait();
+				continue;
+			}
+		} else {
+			// wait for the reader only briefly, so a backlog in another
+			// worker's deques is still stolen while the input is slow
+			count = executor->input_queue->dequeue_bulk_timed(batch, executor->batch_size, WORK_STEALING_IDLE_WAIT_US);
+
+			// once the input is over, stay around to steal until the
+			// other workers have emptied their deques
+			if (count == 0) {
+				Queue<Item*>* input_queue = executor->input_queue;
+				if (input_queue->is_closed() && input_queue->get_size() == 0) {
+					if (executor->pending.load(std::memory_order_acquire) == 0)
+						break;
+					spin.wait();
+				}
+				continue;
+			}
+		}
+
+		executor->pending.fetch_add(count, std::memory_order_relaxed);
+
+		for (int i = count - 1; i >= 0; i--)
+			worker->deques[0].push(batch[i]);
+		idle_rounds = 0;
+		spin.reset();
+	}
+
+	delete [] batch;
+	return nullptr;
+}
+
+#endif // WORK_STEALING_EXECUTOR_HPP
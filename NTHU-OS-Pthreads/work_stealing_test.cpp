@@ -0,0 +1,33 @@
+#include "ts_queue.hpp"
+#include "reader.hpp"
+#include "writer.hpp"
+#include "work_stealing_executor.hpp"
+
+int main() {
+	TSQueue<Item*>* q1;
+	TSQueue<Item*>* q2;
+
+	q1 = new TSQueue<Item*>;
+	q2 = new TSQueue<Item*>;
+
+	Transformer* transformer = new Transformer;
+
+	Reader* reader = new Reader(80, "./tests/01.in", q1);
+	Writer* writer = new Writer(80, "./tests/01.out", q2);
+
+	WorkStealingExecutor* executor = new WorkStealingExecutor(q1, q2, transformer, 4, 8);
+
+	reader->start();
+	writer->start();
+
+	executor->start();
+
+	reader->join();
+	writer->join();
+
+	delete writer;
+	delete reader;
+	delete transformer;
+
+	return 0;
+}
@@ -1,15 +1,27 @@
 #include <fstream>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
+#include "reorder_window.hpp"
+#include "buffered_output.hpp"
+#include "item_pool.hpp"
+#include "pipeline_monitor.hpp"
 
 #ifndef WRITER_HPP
 #define WRITER_HPP
 
+// output backends, or-ed together
+// format into a large buffer and write() it whole, instead of ofstream
+#define WRITER_BUFFERED 0x1
+// write the full buffer from a background thread (implies WRITER_BUFFERED)
+#define WRITER_ASYNC 0x2
+// open the file with O_DIRECT (implies WRITER_BUFFERED)
+#define WRITER_DIRECT 0x4
+
 class Writer : public Thread {
 public:
 	// constructor
-	Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue);
+	Writer(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size = 1, ReorderWindow* window = nullptr, int backend = 0, ItemPool* pool = nullptr, PipelineMonitor* monitor = nullptr);
 
 	// destructor
 	~Writer();
@@ -17,11 +29,30 @@ public:
 	virtual void start() override;
 private:
 	// the expected lines to write,
-	// the writer thread finished after output expected lines of item
+	// the writer thread finished after output expected lines of item,
+	// or once the output queue is closed and drained
 	int expected_lines;
 
 	std::ofstream ofs;
-	TSQueue<Item*> *output_queue;
+	// used instead of ofs when a WRITER_* backend is selected
+	BufferedOutput* output;
+	Queue<Item*> *output_queue;
+
+	// the maximum number of items taken from the output queue at once
+	int batch_size;
+
+	// when set, items are written in input order through this window,
+	// the Reader must share the same window
+	ReorderWindow* window;
+
+	// when set, written items are released back to it for the Reader
+	ItemPool* pool;
+
+	// when set, the latency of every written item is recorded
+	PipelineMonitor* monitor;
+
+	// formats one item to the selected backend, then recycles it
+	void write(Item* item);
 
 	// the method for pthread to create a writer thread
 	static void* process(void* arg);
@@ -29,15 +60,33 @@ private:
 
 // Implementation start
 
-Writer::Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue)
-	: expected_lines(expected_lines), output_queue(output_queue) {
-	ofs = std::ofstream(output_file);
+Writer::Writer(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size, ReorderWindow* window, int backend, ItemPool* pool, PipelineMonitor* monitor)
+	: expected_lines(expected_lines), output_queue(output_queue), batch_size(batch_size), window(window), pool(pool), monitor(monitor) {
+	output = nullptr;
+	if (backend)
+		output = new BufferedOutput(output_file, backend & WRITER_ASYNC, backend & WRITER_DIRECT);
+	else
+		ofs = std::ofstream(output_file);
 }
 
 Writer::~Writer() {
+	delete output;
 	ofs.close();
 }
 
+void Writer::write(Item* item) {
+	if (output)
+		output->write_item(*item);
+	else
+		ofs << *item;
+
+	if (monitor)
+		monitor->record(item);
+
+	if (pool)
+		pool->release(item);
+}
+
 void Writer::start() {
 	// TODO: starts a Writer thread
 	pthread_create(&t, 0, Writer::process, (void*)this);
@@ -47,12 +96,41 @@ void* Writer::process(void* arg) {
 	// TODO: implements the Writer's work
 	Writer* writer = (Writer*)arg;
 
-	while (writer->expected_lines--) {
-		Item *item = new Item;
-		item = writer->output_queue->dequeue();
-		writer->ofs << *item;
+	Item** batch = new Item*[writer->batch_size];
+
+	while (writer->expected_lines != 0) {
+		int max = writer->batch_size;
+		if (writer->expected_lines > 0 && writer->expected_lines < max)
+			max = writer->expected_lines;
+
+		// 0 once the output queue is closed and drained
+		int count = writer->output_queue->dequeue_bulk(batch, max);
+		if (count == 0)
+			break;
+
+		if (writer->window) {
+			for (int i = 0; i < count; i++)
+				writer->window->insert(batch[i]);
+
+			Item* item;
+			while ((item = writer->window->pop_ready()) != nullptr)
+				writer->write(item);
+		} else {
+			for (int i = 0; i < count; i++)
+				writer->write(batch[i]);
+		}
+		if (writer->expected_lines > 0)
+			writer->expected_lines -= count;
 	}
 
+	delete [] batch;
+
+	// the data is on disk once the writer thread is joined
+	if (writer->output)
+		writer->output->flush();
+	else
+		writer->ofs.flush();
+
 	return nullptr;
 }
 
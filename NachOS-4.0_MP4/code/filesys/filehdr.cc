@@ -3,12 +3,12 @@
 //	would be called the i-node).
 //
 //	The file header is used to locate where on disk the
-//	file's data is stored.  We implement this as a fixed size
-//	table of pointers -- each entry in the table points to the
-//	disk sector containing that portion of the file data
-//	(in other words, there are no indirect or doubly indirect
-//	blocks). The table size is chosen so that the file header
-//	will be just big enough to fit in one disk sector,
+//	file's data is stored.  We implement this as a table of extents
+//	(runs of contiguous sectors) in the header sector itself, followed,
+//	for files too fragmented for the table, by a single-indirect and a
+//	double-indirect index block.  The layout of the disk part is chosen
+//	so that the file header will be just big enough to fit in one disk
+//	sector.
 //
 //      Unlike in a real system, we do not keep track of file permissions,
 //	ownership, last modification date, etc., in the file header.
@@ -17,6 +17,7 @@
 //	   for a new file, by modifying the in-memory data structure
 //	     to point to the newly allocated data blocks
 //	   for a file already on disk, by reading the file header from disk
+//	     (the index blocks are read later, when they are first needed)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -29,44 +30,59 @@
 #include "synchdisk.h"
 #include "main.h"
 
+//----------------------------------------------------------------------
+// FreeSector
+// 	Return one sector of a file to the map of free sectors.
+//----------------------------------------------------------------------
+
+static void
+FreeSector(PersistentBitmap *freeMap, int sector)
+{
+	ASSERT(freeMap->Test(sector)); // ought to be marked!
+	freeMap->Clear(sector);
+}
+
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::FileHeader
 //	There is no need to initialize a fileheader,
 //	since all the information should be initialized by Allocate or FetchFrom.
-//	The purpose of this function is to keep valgrind happy.
+//	The purpose of this function is to keep valgrind happy, and to
+//	start with no index blocks in memory.
 //----------------------------------------------------------------------
 FileHeader::FileHeader()
 {
-	//555555555555555555555555555555555555555555555555
-	NextFileHeader = NULL;
-	NextFileHeaderSector = -1;
-	//555555555555555555555555555555555555555555555555
+	// the disk part is read and written as one sector
+	ASSERT((char *)extentEnd - (char *)this == SectorSize);
 
 	numBytes = -1;
 	numSectors = -1;
-	memset(dataSectors, -1, sizeof(dataSectors));
+	for (int i = 0; i < NumExtents; i++)
+	{
+		extents[i].start = -1;
+		extents[i].length = 0;
+		extentEnd[i] = 0;
+	}
+	singleIndirect = doubleIndirect = -1;
+
+	extentSectors = 0;
+	singleIndex = doubleIndex = NULL;
+	for (int i = 0; i < NumIndirect; i++)
+		secondIndex[i] = NULL;
+	indexDirty = FALSE;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	De-allocate the index blocks read into memory.
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
-	//555555555555555555555555555555555555555555555555
-	/*if(NextFileHeader != NULL){
-		NextFileHeader->~FileHeader(); 
-		delete NextFileHeader;
-	}*/
-	if(NextFileHeader != NULL){
-		delete NextFileHeader;
-	}
-	//555555555555555555555555555555555555555555555555
+	delete[] singleIndex;
+	delete[] doubleIndex;
+	for (int i = 0; i < NumIndirect; i++)
+		delete[] secondIndex[i];
 }
 
 //----------------------------------------------------------------------
@@ -74,112 +90,232 @@ FileHeader::~FileHeader()
 // 	Initialize a fresh file header for a newly created file.
 //	Allocate data blocks for the file out of the map of free disk blocks.
 //	Return FALSE if there are not enough free blocks to accomodate
-//	the new file.
+//	the new file (the caller then discards "freeMap").
+//
+//	The data is allocated in runs of contiguous sectors, as few as
+//	the free map allows, starting on the track of "goal" (the sector
+//	of the header, so that reading the file does not seek away from
+//	it) and each continuing where the previous one ended.
 //
 //	"freeMap" is the bit map of free disk sectors
-//	"fileSize" is the bit map of free disk sectors
+//	"fileSize" is the size of the file, in bytes
+//	"goal" is the sector to allocate near, -1 for anywhere
 //----------------------------------------------------------------------
 
-bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize, int goal)
 {
-	//555555555555555555555555555555555555555555555555
-	if(fileSize > MaxFileSize)
-		numBytes = MaxFileSize;
-	else
-		numBytes = fileSize;
-		
-	if (freeMap->NumClear() * (SectorSize) < fileSize)
+	numBytes = fileSize;
+	numSectors = divRoundUp(fileSize, SectorSize);
+	if (freeMap->NumClear() < numSectors)
 		return FALSE; // not enough space
-	/*printf("%d %d\n", freeMap->NumClear(), fileSize);*/
-	fileSize -= numBytes;
-	numSectors = divRoundUp(numBytes, SectorSize);
 
-	for (int i = 0; i < numSectors; i++)
+	for (int i = 0, length; i < numSectors; i += length)
+	{
+		int first = freeMap->FindAndSetRun(goal, numSectors - i, &length);
+		// the check above does not count the index blocks, which
+		// may take the last free sectors of a fragmented disk
+		if (first < 0)
+			return FALSE; // not enough space
+		if (!AddSectors(freeMap, i, first, length))
+			return FALSE; // no space left for an index block
+		goal = first + length;
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AddSectors
+// 	Record that the file's sectors from "fileSector" on are stored in
+//	the "count" disk sectors starting at "first".  The run extends the
+//	last extent if it follows on from it, otherwise it takes a new
+//	extent; once the extents are used up (or an index block is in
+//	use), the sectors go into the index blocks, which are allocated
+//	out of "freeMap" as they are needed.
+//----------------------------------------------------------------------
+
+bool FileHeader::AddSectors(PersistentBitmap *freeMap, int fileSector,
+							int first, int count)
+{
+	if (fileSector == extentSectors)
 	{
-		dataSectors[i] = freeMap->FindAndSet();
-		// since we checked that there was enough free space,
-		// we expect this to succeed
-		ASSERT(dataSectors[i] >= 0);
+		int last = NumExtents - 1;
+		while (last >= 0 && extents[last].length == 0)
+			last--;
+
+		if (last >= 0 && extents[last].start + extents[last].length == first)
+		{
+			extents[last].length += count;
+			ComputeExtentEnds();
+			return TRUE;
+		}
+		if (last + 1 < NumExtents)
+		{
+			extents[last + 1].start = first;
+			extents[last + 1].length = count;
+			ComputeExtentEnds();
+			return TRUE;
+		}
 	}
-	if(fileSize > 0){
-		NextFileHeaderSector = freeMap->FindAndSet();
 
-		ASSERT(NextFileHeaderSector >= 0);
+	for (; count > 0; fileSector++, first++, count--)
+	{
+		int i = fileSector - extentSectors;
+		if (i < NumIndirect)
+		{
+			if (singleIndex == NULL && NewIndex(freeMap, &singleIndex, &singleIndirect) == NULL)
+				return FALSE;
+			singleIndex[i] = first;
+			continue;
+		}
 
-		NextFileHeader = new FileHeader;
-		return NextFileHeader->Allocate(freeMap, fileSize);
+		i -= NumIndirect;
+		ASSERT(i < NumIndirect * NumIndirect);
+		if (doubleIndex == NULL && NewIndex(freeMap, &doubleIndex, &doubleIndirect) == NULL)
+			return FALSE;
+		int j = i / NumIndirect;
+		if (secondIndex[j] == NULL && NewIndex(freeMap, &secondIndex[j], &doubleIndex[j]) == NULL)
+			return FALSE;
+		secondIndex[j][i % NumIndirect] = first;
 	}
 	return TRUE;
-	//555555555555555555555555555555555555555555555555
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NewIndex
+// 	Allocate a sector for an index block, and an empty copy of it in
+//	memory, to be written by WriteBack.  Return NULL if the disk is
+//	full.
+//
+//	"index" -- where to keep the in-memory copy
+//	"sector" -- where to record the index block's sector
+//----------------------------------------------------------------------
+
+int *FileHeader::NewIndex(PersistentBitmap *freeMap, int **index, int *sector)
+{
+	*sector = freeMap->FindAndSet();
+	if (*sector == -1)
+		return NULL;
+
+	*index = new int[NumIndirect];
+	for (int i = 0; i < NumIndirect; i++)
+		(*index)[i] = -1;
+	indexDirty = TRUE;
+	return *index;
+}
 
+//----------------------------------------------------------------------
+// FileHeader::LoadIndex
+// 	Return the contents of an index block, reading it from disk the
+//	first time.
+//
+//	"index" -- where the in-memory copy is kept, NULL if not read yet
+//	"sector" -- the index block's sector
+//----------------------------------------------------------------------
+
+int *FileHeader::LoadIndex(int **index, int sector)
+{
+	if (*index == NULL)
+	{
+		ASSERT(sector >= 0);
+		*index = new int[NumIndirect];
+		kernel->synchDisk->ReadSector(sector, (char *)*index);
+	}
+	return *index;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ComputeExtentEnds
+// 	Rebuild the in-core summary of the extents, after they have been
+//	read from disk or changed.  Unused extents end where the last used
+//	one does, so that extentEnd stays sorted for ByteToSector.
+//----------------------------------------------------------------------
+
+void FileHeader::ComputeExtentEnds()
+{
+	extentSectors = 0;
+	for (int i = 0; i < NumExtents; i++)
+	{
+		extentSectors += extents[i].length;
+		extentEnd[i] = extentSectors;
+	}
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
-// 	De-allocate all the space allocated for data blocks for this file.
+// 	De-allocate all the space allocated for data blocks for this file,
+//	and for its index blocks.
 //
 //	"freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
 void FileHeader::Deallocate(PersistentBitmap *freeMap)
 {
-	for (int i = 0; i < numSectors; i++)
+	int remaining = numSectors - extentSectors; // in index blocks
+
+	for (int i = 0; i < NumExtents; i++)
+		for (int j = 0; j < extents[i].length; j++)
+			FreeSector(freeMap, extents[i].start + j);
+
+	if (singleIndirect != -1)
 	{
-		ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
-		freeMap->Clear((int)dataSectors[i]);
+		int *index = LoadIndex(&singleIndex, singleIndirect);
+		for (int i = 0; i < NumIndirect && remaining > 0; i++, remaining--)
+			FreeSector(freeMap, index[i]);
+		FreeSector(freeMap, singleIndirect);
+	}
+
+	if (doubleIndirect != -1)
+	{
+		int *top = LoadIndex(&doubleIndex, doubleIndirect);
+		for (int j = 0; j < NumIndirect && remaining > 0; j++)
+		{
+			int *index = LoadIndex(&secondIndex[j], top[j]);
+			for (int i = 0; i < NumIndirect && remaining > 0; i++, remaining--)
+				FreeSector(freeMap, index[i]);
+			FreeSector(freeMap, top[j]);
+		}
+		FreeSector(freeMap, doubleIndirect);
 	}
-	//555555555555555555555555555555555555555555555555
-	if(NextFileHeader != NULL && NextFileHeaderSector != -1)
-		NextFileHeader->Deallocate(freeMap);
-	//555555555555555555555555555555555555555555555555
 }
 
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-// 	Fetch contents of file header from disk.
+// 	Fetch contents of file header from disk.  The index blocks are
+//	left on disk until ByteToSector or Deallocate needs them.
 //
 //	"sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
 
 void FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this + sizeof(FileHeader*));
-	//555555555555555555555555555555555555555555555555
-	if(NextFileHeaderSector != -1){
-		NextFileHeader = new FileHeader;
-		NextFileHeader->FetchFrom(NextFileHeaderSector);
-	}
-	//555555555555555555555555555555555555555555555555
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	kernel->synchDisk->ReadSector(sector, (char *)this);
+	ComputeExtentEnds();
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
-// 	Write the modified contents of the file header back to disk.
+// 	Write the modified contents of the file header back to disk,
+//	along with the index blocks allocated for it.
 //
 //	"sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
 
 void FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this + sizeof(FileHeader*));
+	kernel->synchDisk->WriteSector(sector, (char *)this);
 
-	//555555555555555555555555555555555555555555555555
-	if(NextFileHeaderSector != -1){
-		NextFileHeader->WriteBack(NextFileHeaderSector);
+	if (!indexDirty)
+		return;
+	if (singleIndex != NULL)
+		kernel->synchDisk->WriteSector(singleIndirect, (char *)singleIndex);
+	if (doubleIndex != NULL)
+	{
+		kernel->synchDisk->WriteSector(doubleIndirect, (char *)doubleIndex);
+		for (int i = 0; i < NumIndirect; i++)
+			if (secondIndex[i] != NULL)
+				kernel->synchDisk->WriteSector(doubleIndex[i], (char *)secondIndex[i]);
 	}
-	//555555555555555555555555555555555555555555555555	
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	indexDirty = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -189,23 +325,38 @@ void FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	Within the extents this is a binary search for the first extent
+//	ending after the sector; past them, one or two index block lookups.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int FileHeader::ByteToSector(int offset)
 {
-	//555555555555555555555555555555555555555555555555	
+	int i = offset / SectorSize;
 
-	int SectorIndex = offset / SectorSize;
-
-	if(SectorIndex < NumDirect)
-		return (dataSectors[SectorIndex]);
-	else{
-		ASSERT(NextFileHeader != NULL)
-		return NextFileHeader->ByteToSector(offset - MaxFileSize);
+	if (i < extentSectors)
+	{
+		int lo = 0, hi = NumExtents - 1;
+		while (lo < hi)
+		{
+			int mid = (lo + hi) / 2;
+			if (extentEnd[mid] > i)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return extents[lo].start + i - (extentEnd[lo] - extents[lo].length);
 	}
-	//555555555555555555555555555555555555555555555555	
 
+	i -= extentSectors;
+	if (i < NumIndirect)
+		return LoadIndex(&singleIndex, singleIndirect)[i];
+
+	i -= NumIndirect;
+	ASSERT(i < NumIndirect * NumIndirect);
+	int *top = LoadIndex(&doubleIndex, doubleIndirect);
+	return LoadIndex(&secondIndex[i / NumIndirect], top[i / NumIndirect])[i % NumIndirect];
 }
 
 //----------------------------------------------------------------------
@@ -231,11 +382,11 @@ void FileHeader::Print()
 
 	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
 	for (i = 0; i < numSectors; i++)
-		printf("%d ", dataSectors[i]);
+		printf("%d ", ByteToSector(i * SectorSize));
 	printf("\nFile contents:\n");
 	for (i = k = 0; i < numSectors; i++)
 	{
-		kernel->synchDisk->ReadSector(dataSectors[i], data);
+		kernel->synchDisk->ReadSector(ByteToSector(i * SectorSize), data);
 		for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 		{
 			if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -16,22 +16,39 @@
 
 #include "disk.h"
 #include "pbitmap.h"
-//555555555555555555555555555555555555555555555
-#define NumDirect ((SectorSize - 3 * sizeof(int)) / sizeof(int))
-//555555555555555555555555555555555555555555555
 
-#define MaxFileSize (NumDirect * SectorSize)
+// Number of extents that fit in the header sector, next to numBytes,
+// numSectors and the two index block sectors
+#define NumExtents ((int)((SectorSize - 4 * sizeof(int)) / (2 * sizeof(int))))
+
+// Number of sector numbers in one index block
+#define NumIndirect ((int)(SectorSize / sizeof(int)))
+
+// A run of "length" consecutive disk sectors starting at "start",
+// holding consecutive sectors of the file
+class Extent
+{
+public:
+	int start;
+	int length; // 0 if the extent is unused
+};
 
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks.
+//
+// The first sectors of the file are described by a table of extents,
+// so a file that lies in a few contiguous runs needs nothing more than
+// its header; the sector of an offset is found by binary search over
+// the extents.  Sectors beyond what the extents hold (once the file is
+// too fragmented for the table) are listed in index blocks: first a
+// single-indirect block of NumIndirect sectors, then a double-indirect
+// block of NumIndirect more index blocks, enough for the whole disk.
+// Index blocks are only read from disk the first time they are needed.
 //
 // The file header data structure can be stored in memory or on disk.
 // When it is on disk, it is stored in a single sector -- this means
-// that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// that we assume the size of the disk part of this data structure to
+// be the same as one disk sector.
 //
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
@@ -44,9 +61,11 @@ public:
 	FileHeader(); // dummy constructor to keep valgrind happy
 	~FileHeader();
 
-	bool Allocate(PersistentBitmap *bitMap, int fileSize); // Initialize a file header,
+	bool Allocate(PersistentBitmap *bitMap, int fileSize,
+				  int goal = -1);						   // Initialize a file header,
 														   //  including allocating space
-														   //  on disk for the file data
+														   //  on disk for the file data,
+														   //  near sector "goal" if given
 	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's
 														   //  data blocks
 
@@ -62,39 +81,42 @@ public:
 					  // in bytes
 
 	void Print(); // Print the contents of the file.
-	//555555555555555555555555555555555555555555555
-	FileHeader* FindNextFileHeader()
-	{
-		return NextFileHeader;
-	}	
-	//555555555555555555555555555555555555555555555
-
 
 private:
-	//555555555555555555555555555555555555555555555
-	FileHeader* NextFileHeader;	
-	int NextFileHeaderSector;
-	//555555555555555555555555555555555555555555555
-
 	/*
-		MP4 hint:
-		You will need a data structure to store more information in a header.
-		Fields in a class can be separated into disk part and in-core part.
-		Disk part are data that will be written into disk.
-		In-core part are data only lies in memory, and are used to maintain the data structure of this class.
-		In order to implement a data structure, you will need to add some "in-core" data
-		to maintain data structure.
-		
-		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
-		written to a sector on disk.
-		In-core part - none
-		
+		Disk part - numBytes, numSectors, extents, singleIndirect and
+		doubleIndirect occupy exactly 128 bytes, at the start of the
+		object, and are read and written as one sector.
+		In-core part - everything after them.
 	*/
 
-	int numBytes;				// Number of bytes in the file
-	int numSectors;				// Number of data sectors in the file
-	int dataSectors[NumDirect]; // Disk sector numbers for each data
-								// block in the file
+	int numBytes;				  // Number of bytes in the file
+	int numSectors;				  // Number of data sectors in the file
+	Extent extents[NumExtents];	  // The first data sectors, in runs
+	int singleIndirect;			  // Index block for the sectors after
+								  // the extents, -1 if none
+	int doubleIndirect;			  // Index block of index blocks for
+								  // the sectors after that, -1 if none
+
+	int extentEnd[NumExtents];	  // File sector after each extent
+	int extentSectors;			  // Data sectors held by the extents
+	int *singleIndex;			  // Contents of singleIndirect,
+								  // NULL until it is needed
+	int *doubleIndex;			  // Contents of doubleIndirect, likewise
+	int *secondIndex[NumIndirect]; // Contents of the index blocks listed
+								   // by doubleIndex, likewise
+	bool indexDirty;			  // Index blocks to be written back?
+
+	bool AddSectors(PersistentBitmap *freeMap, int fileSector,
+					int first, int count);
+	// Append a run of data sectors to the
+	// file, FALSE if an index block is needed
+	// and the disk is full
+	void ComputeExtentEnds(); // Rebuild extentEnd and extentSectors
+	int *LoadIndex(int **index, int sector);
+	// Read an index block, if not read yet
+	int *NewIndex(PersistentBitmap *freeMap, int **index, int *sector);
+	// Allocate an empty index block
 };
 
 #endif // FILEHDR_H
@@ -51,6 +51,8 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "synchdisk.h"
+#include "main.h"
 //55555555555555555555555555555555555555
 #include <string.h>
 //55555555555555555555555555555555555555
@@ -100,8 +102,8 @@ FileSystem::FileSystem(bool format)
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
 
-        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-        ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize, FreeMapSector));
+        ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize, DirectorySector));
 
         // Flush the bitmap and directory FileHeaders back to disk
         // We need to do this before we can "Open" the file, since open
@@ -151,11 +153,14 @@ FileSystem::FileSystem(bool format)
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileSystem::~FileSystem
+//	Close the bitmap and directory files, and write everything still
+//	dirty in the disk's buffer cache back to disk.
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
     delete freeMapFile;
     delete directoryFile;
+    kernel->synchDisk->FlushCache();
 }
 
 //----------------------------------------------------------------------
@@ -291,9 +296,10 @@ bool FileSystem::Create(char *name, int initialSize, bool IsDir)
         else
         {
             hdr = new FileHeader;
-            if(IsDir && (!hdr->Allocate(freeMap, DirectoryFileSize)))
+            // keep the data on the header's track if it fits
+            if(IsDir && (!hdr->Allocate(freeMap, DirectoryFileSize, sector)))
                 success = FALSE;
-            else if ((!IsDir) && (!hdr->Allocate(freeMap, initialSize))){
+            else if ((!IsDir) && (!hdr->Allocate(freeMap, initialSize, sector))){
                 success = FALSE; // no space on disk for data
                 //printf("4\n");
             }
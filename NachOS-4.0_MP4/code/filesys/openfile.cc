@@ -31,6 +31,9 @@ OpenFile::OpenFile(int sector)
     hdr = new FileHeader;
     hdr->FetchFrom(sector);
     seekPosition = 0;
+    readAheadNext = 0; // a read from the start counts as sequential
+    readAheadWindow = 0;
+    readAheadStart = readAheadEnd = 0;
 }
 
 //----------------------------------------------------------------------
@@ -132,6 +135,7 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
     for (i = firstSector; i <= lastSector; i++)
         kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
                                       &buf[(i - firstSector) * SectorSize]);
+    ReadAhead(firstSector, lastSector, fileLength);
 
     // copy the part we want
     bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
@@ -167,11 +171,13 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
     lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
 
     // read in first and last sector, if they are to be partially modified
+    // (straight from the disk, so that writes do not look like reads
+    // to read-ahead)
     if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
+        kernel->synchDisk->ReadSector(hdr->ByteToSector(firstSector * SectorSize), buf);
     if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+        kernel->synchDisk->ReadSector(hdr->ByteToSector(lastSector * SectorSize),
+                                      &buf[(lastSector - firstSector) * SectorSize]);
 
     // copy in the bytes we want to change
     bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
@@ -184,6 +190,57 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Called by ReadAt after reading sectors "firstSector" through
+//	"lastSector" of the file.  A read is sequential if it starts
+//	where the previous one ended (or in the same sector, for reads
+//	smaller than a sector).  The first sequential read queues a
+//	window of InitialReadAhead sectors after it; when the reader
+//	reaches the start of the last window, the window doubles (up to
+//	MaxReadAhead) and the next one is queued after it, so that there
+//	is always a window of sectors on the way ahead of the reader.
+//
+//	"firstSector", "lastSector" -- the sectors read, within the file
+//	"fileLength" -- the length of the file, in bytes
+//----------------------------------------------------------------------
+
+void OpenFile::ReadAhead(int firstSector, int lastSector, int fileLength)
+{
+    int fileSectors = divRoundUp(fileLength, SectorSize);
+    int sectors[MaxReadAhead];
+    int i, end;
+
+    if ((firstSector != readAheadNext) && (firstSector != readAheadNext - 1))
+    {
+        readAheadWindow = 0; // random access
+        readAheadNext = lastSector + 1;
+        return;
+    }
+    readAheadNext = lastSector + 1;
+
+    if (readAheadWindow == 0)
+    {
+        readAheadWindow = InitialReadAhead;
+        readAheadEnd = lastSector + 1;
+    }
+    else if (lastSector >= readAheadStart)
+        readAheadWindow = min(readAheadWindow * 2, MaxReadAhead);
+    else
+        return; // still ahead of the reader
+
+    readAheadStart = max(readAheadEnd, lastSector + 1);
+    end = min(readAheadStart + readAheadWindow, fileSectors);
+    for (i = readAheadStart; i < end; i++)
+        sectors[i - readAheadStart] = hdr->ByteToSector(i * SectorSize);
+    if (end > readAheadStart)
+    {
+        DEBUG(dbgFile, "Reading ahead sectors " << readAheadStart << " to " << end - 1);
+        kernel->synchDisk->ReadAhead(sectors, end - readAheadStart);
+        readAheadEnd = end;
+    }
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -191,15 +248,7 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
 
 int OpenFile::Length()
 {
-    //5555555555555555555555555555555555555555555
-    int TotalFileLength = 0;
-    FileHeader* Hdrptr = hdr;
-    while(Hdrptr != NULL){
-        TotalFileLength += Hdrptr->FileLength();
-        Hdrptr = Hdrptr->FindNextFileHeader();
-    }
-    return TotalFileLength;
-    //5555555555555555555555555555555555555555555
+    return hdr->FileLength();
 }
 
 #endif //FILESYS_STUB
@@ -75,6 +75,14 @@ private:
 #else // FILESYS
 class FileHeader;
 
+// Sequential reads make an OpenFile read the next sectors of the file
+// ahead, into the disk's buffer cache (cf. synchdisk.h).  Like Linux,
+// the window starts small and doubles each time the reader catches up
+// with the last window read ahead, up to a limit; any other access
+// pattern turns read-ahead off until the reads are sequential again.
+const int InitialReadAhead = 4; // sectors read ahead at first
+const int MaxReadAhead = 16;	// largest read-ahead window, in sectors
+
 class OpenFile
 {
 public:
@@ -104,6 +112,14 @@ public:
 private:
 	FileHeader *hdr;  // Header for this file
 	int seekPosition; // Current position within the file
+
+	void ReadAhead(int firstSector, int lastSector, int fileLength);
+	// Having read sectors first..last of the
+	// file, read ahead if that was sequential
+	int readAheadNext;	 // the sector a sequential read starts at
+	int readAheadWindow; // current window, 0 if not reading ahead
+	int readAheadStart;	 // first sector of the last window
+	int readAheadEnd;	 // sector after the last window
 };
 
 #endif // FILESYS
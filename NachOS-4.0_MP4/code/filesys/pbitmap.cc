@@ -7,7 +7,11 @@
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
+#include "debug.h"
 #include "pbitmap.h"
+#include "disk.h"
+
+int PersistentBitmap::nextFit = 0;
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -41,6 +45,7 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
     // but we will just overwrite that with the contents of the
     // map found in the file
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Rebuild();
 }
 
 //----------------------------------------------------------------------
@@ -62,6 +67,7 @@ PersistentBitmap::~PersistentBitmap()
 void PersistentBitmap::FetchFrom(OpenFile *file)
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Rebuild();
 }
 
 //----------------------------------------------------------------------
@@ -75,3 +81,79 @@ void PersistentBitmap::WriteBack(OpenFile *file)
 {
     file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
 }
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSetRun
+// 	Find a run of clear bits, set them, and return the first one.
+//	Runs of the full "maxLength" are looked for in this order:
+//	   on the track of "goal", from "goal" on and then before it
+//	   from the next-fit position to the end of the map, then from
+//	     the start of the map
+//	If there is no such run, the first clear bits from the next-fit
+//	position on (wrapping around) are taken, as many as are clear in
+//	a row.  The next-fit position moves to just after the run.
+//
+//	"goal" -- the bit to allocate near, -1 for no preference
+//	"maxLength" -- the most bits to set
+//	"length" -- set to the number of bits actually set
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSetRun(int goal, int maxLength, int *length)
+{
+    int start = -1;
+
+    ASSERT(maxLength > 0);
+    if (nextFit >= numBits)
+        nextFit = 0;
+
+    if (goal >= 0 && goal < numBits)
+    {
+        int trackStart = goal - goal % SectorsPerTrack;
+        int trackEnd = min(trackStart + SectorsPerTrack, numBits);
+        start = FindRun(goal, trackEnd, maxLength);
+        if (start == -1)
+            start = FindRun(trackStart, trackEnd, maxLength);
+    }
+    if (start == -1)
+        start = FindRun(nextFit, numBits, maxLength);
+    if (start == -1)
+        start = FindRun(0, numBits, maxLength);
+
+    if (start != -1)
+        *length = maxLength;
+    else
+    {
+        start = NextClear(nextFit);
+        if (start == -1)
+            start = NextClear(0);
+        if (start == -1)
+            return -1; // the map is full
+        *length = NextSet(start, min(start + maxLength, numBits)) - start;
+    }
+
+    for (int i = start; i < start + *length; i++)
+        Mark(i);
+    nextFit = start + *length;
+    return start;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindRun
+// 	Return the first bit of the first run of "length" clear bits lying
+//	within [from, to), or -1 if there is none.  Each hole too small
+//	for the run is skipped as a whole.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindRun(int from, int to, int length) const
+{
+    int start = NextClear(from);
+
+    while (start != -1 && start + length <= to)
+    {
+        int end = NextSet(start, start + length);
+        if (end == start + length)
+            return start;
+        start = NextClear(end);
+    }
+    return -1;
+}
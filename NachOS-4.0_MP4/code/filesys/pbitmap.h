@@ -20,6 +20,12 @@
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
 // be read from and stored to the disk.
+//
+// As the map of free disk sectors, it also hands out runs of
+// contiguous sectors (FindAndSetRun), preferring the track of a
+// "goal" sector -- typically the file header -- and otherwise the
+// next free space after the previous run (next fit), so that a
+// file's data ends up in few runs, close to its header.
 
 class PersistentBitmap : public Bitmap
 {
@@ -31,6 +37,21 @@ public:
 
     void FetchFrom(OpenFile *file); // read bitmap from the disk
     void WriteBack(OpenFile *file); // write bitmap contents to disk
+
+    int FindAndSetRun(int goal, int maxLength, int *length);
+    // Set a run of up to "maxLength" clear
+    // bits, near bit "goal" if it is not -1.
+    // Return the first bit and the length
+    // of the run, or -1 if no bit is clear
+
+private:
+    static int nextFit; // where the search for a run starts
+                        // when there is no goal; shared by
+                        // every copy of the free map
+
+    int FindRun(int from, int to, int length) const;
+    // First run of "length" clear bits
+    // within [from, to), -1 if none
 };
 
 #endif // PBITMAP_H
@@ -10,35 +10,74 @@
 //	handle one operation at a time, use a lock to enforce mutual
 //	exclusion.
 //
+//	On top of that sits a write-back buffer cache of whole sectors.
+//	A read that hits the cache costs no simulated disk time at all;
+//	a write only dirties the cached copy.  Dirty sectors are written
+//	out when they are evicted, or by FlushCache.  The lock is held
+//	across the whole operation, so the cache needs no locking of its own.
+//
+//	Read-ahead fills the cache from the disk interrupt handler, one
+//	sector at a time.  It only touches the cache while no read or
+//	write owns the disk (see AcquireDisk), and never evicts a dirty
+//	sector, since writing it back would mean waiting.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "main.h"
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"cacheSectors" -- how many sectors the buffer cache holds
+//	"policy" -- how the buffer cache chooses a sector to evict
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(int cacheSectors, CachePolicy policy)
 {
     semaphore = new Semaphore("synch disk", 0);
     lock = new Lock("synch disk lock");
     disk = new Disk(this);
+
+    ASSERT(cacheSectors >= 0);
+    cacheSize = cacheSectors;
+    this->policy = policy;
+    cache = new CacheEntry[cacheSize];
+    for (int i = 0; i < cacheSize; i++)
+    {
+        cache[i].sector = -1;
+        cache[i].dirty = FALSE;
+        cache[i].referenced = FALSE;
+        cache[i].lastUsed = 0;
+    }
+    cached = new int[NumSectors];
+    for (int i = 0; i < NumSectors; i++)
+        cached[i] = -1;
+    hand = 0;
+    useCount = 0;
+    readAheadFirst = readAheadCount = 0;
+    readAheadSector = -1;
+    diskOwned = FALSE;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
 // 	De-allocate data structures needed for the synchronous disk
-//	abstraction.
+//	abstraction.  Anything still dirty in the cache is written back
+//	first.
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk()
 {
+    readAheadCount = 0; // nothing new, but let the one in flight finish
+    FlushCache();
+    delete[] cached;
+    delete[] cache;
     delete disk;
     delete lock;
     delete semaphore;
@@ -55,16 +94,34 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
+    CacheEntry *entry;
+
     lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
+    AcquireDisk();
+    if (cacheSize == 0)
+        DiskRead(sectorNumber, data);
+    else
+    {
+        entry = Lookup(sectorNumber);
+        if (entry != NULL)
+            kernel->stats->numDiskCacheHits++;
+        else
+        {
+            kernel->stats->numDiskCacheMisses++;
+            entry = Allocate(sectorNumber);
+            DiskRead(sectorNumber, entry->data);
+        }
+        bcopy(entry->data, data, SectorSize);
+    }
+    ReleaseDisk();
     lock->Release();
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
 // 	Write the contents of a buffer into a disk sector.  Return only
-//	after the data has been written.
+//	after the data has been written -- to the cache, that is; the
+//	sector reaches the disk when it is evicted or flushed.
 //
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
@@ -72,19 +129,289 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
+    CacheEntry *entry;
+
     lock->Acquire(); // only one disk I/O at a time
+    AcquireDisk();
+    if (cacheSize == 0)
+        DiskWrite(sectorNumber, data);
+    else
+    {
+        // the whole sector is overwritten, so a miss need not read it first
+        entry = Lookup(sectorNumber);
+        if (entry != NULL)
+            kernel->stats->numDiskCacheHits++;
+        else
+        {
+            kernel->stats->numDiskCacheMisses++;
+            entry = Allocate(sectorNumber);
+        }
+        bcopy(data, entry->data, SectorSize);
+        entry->dirty = TRUE;
+    }
+    ReleaseDisk();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FlushCache
+// 	Write every dirty sector in the cache back to disk.  The sectors
+//	stay cached.  Called when the file system shuts down; until then
+//	the disk may not hold the latest contents of a sector.
+//----------------------------------------------------------------------
+
+void SynchDisk::FlushCache()
+{
+    lock->Acquire();
+    AcquireDisk();
+    for (int i = 0; i < cacheSize; i++)
+    {
+        if (cache[i].sector != -1 && cache[i].dirty)
+        {
+            DiskWrite(cache[i].sector, cache[i].data);
+            cache[i].dirty = FALSE;
+        }
+    }
+    ReleaseDisk();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadAhead
+// 	Queue sectors to be read into the cache in the background, and
+//	start on the first one if the disk is free.  Return without
+//	waiting.  Sectors already cached are skipped when their turn
+//	comes; sectors that do not fit in the queue are dropped.
+//
+//	"sectors" -- the disk sectors to read, in the order to read them
+//	"count" -- how many there are
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadAhead(int *sectors, int count)
+{
+    if (cacheSize == 0)
+        return;
+
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    for (int i = 0; i < count && readAheadCount < ReadAheadQueueSize; i++)
+    {
+        ASSERT((sectors[i] >= 0) && (sectors[i] < NumSectors));
+        readAheadQueue[(readAheadFirst + readAheadCount) % ReadAheadQueueSize] = sectors[i];
+        readAheadCount++;
+    }
+    if (!diskOwned)
+        StartReadAhead();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::AcquireDisk
+// 	Take the disk for a read or write: wait for the read-ahead in
+//	flight (if any) to complete, and keep new ones from starting
+//	until ReleaseDisk.  The caller holds the lock.
+//----------------------------------------------------------------------
+
+void SynchDisk::AcquireDisk()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    diskOwned = TRUE;
+    if (readAheadSector != -1)
+        semaphore->P(); // CallBack wakes us when it completes
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReleaseDisk
+// 	Give the disk back to read-ahead, starting the next queued
+//	sector.  The caller holds the lock.
+//----------------------------------------------------------------------
+
+void SynchDisk::ReleaseDisk()
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+    diskOwned = FALSE;
+    StartReadAhead();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartReadAhead
+// 	Send the next queued sector that is not already cached to the
+//	disk, into the entry the replacement policy gives up.  If that
+//	entry is dirty, read-ahead stops and the queue is dropped.
+//	Called with interrupts off, either by a thread or by CallBack.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartReadAhead()
+{
+    while (readAheadSector == -1 && readAheadCount > 0)
+    {
+        int sector = readAheadQueue[readAheadFirst];
+        readAheadFirst = (readAheadFirst + 1) % ReadAheadQueueSize;
+        readAheadCount--;
+        if (cached[sector] != -1)
+            continue; // read (or written) since it was queued
+
+        int victim = Victim();
+        CacheEntry *entry = &cache[victim];
+        if (entry->sector != -1)
+        {
+            if (entry->dirty)
+            {
+                readAheadCount = 0;
+                return;
+            }
+            cached[entry->sector] = -1;
+        }
+
+        entry->sector = sector;
+        entry->dirty = FALSE;
+        cached[sector] = victim;
+        Touch(entry);
+
+        readAheadSector = sector;
+        kernel->stats->numDiskReadAheads++;
+        disk->ReadRequest(sector, entry->data);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::DiskRead
+// SynchDisk::DiskWrite
+// 	Send one request to the disk and wait for it to complete.  The
+//	caller holds the lock.
+//----------------------------------------------------------------------
+
+void SynchDisk::DiskRead(int sectorNumber, char *data)
+{
+    disk->ReadRequest(sectorNumber, data);
+    semaphore->P(); // wait for interrupt
+}
+
+void SynchDisk::DiskWrite(int sectorNumber, char *data)
+{
     disk->WriteRequest(sectorNumber, data);
     semaphore->P(); // wait for interrupt
-    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Lookup
+// 	Return the cache entry holding a sector, marking it as used, or
+//	NULL if the sector is not cached.
+//
+//	"sectorNumber" -- the sector to look for
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::Lookup(int sectorNumber)
+{
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    if (cached[sectorNumber] == -1)
+        return NULL;
+
+    CacheEntry *entry = &cache[cached[sectorNumber]];
+    Touch(entry);
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Allocate
+// 	Find an entry for a sector that is not cached: a free one if
+//	there is any, otherwise the victim of the replacement policy,
+//	which is written back first if it is dirty.  The entry's data
+//	is left for the caller to fill in.
+//
+//	"sectorNumber" -- the sector the entry will hold
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::Allocate(int sectorNumber)
+{
+    int victim = Victim();
+    CacheEntry *entry = &cache[victim];
+    if (entry->sector != -1)
+    {
+        if (entry->dirty)
+            DiskWrite(entry->sector, entry->data);
+        cached[entry->sector] = -1;
+    }
+
+    entry->sector = sectorNumber;
+    entry->dirty = FALSE;
+    cached[sectorNumber] = victim;
+    Touch(entry);
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Victim
+// 	Return the index of the entry to evict next: a free one if there
+//	is any, otherwise the one chosen by the replacement policy.
+//----------------------------------------------------------------------
+
+int SynchDisk::Victim()
+{
+    int victim = -1;
+
+    if (policy == CacheLRU)
+    {
+        for (int i = 0; i < cacheSize; i++)
+        {
+            if (cache[i].sector == -1)
+            {
+                victim = i;
+                break;
+            }
+            if (victim == -1 || cache[i].lastUsed < cache[victim].lastUsed)
+                victim = i;
+        }
+    }
+    else
+    {
+        // give every referenced entry a second chance; free entries
+        // are never referenced, so they are taken in hand order
+        while (cache[hand].referenced)
+        {
+            cache[hand].referenced = FALSE;
+            hand = (hand + 1) % cacheSize;
+        }
+        victim = hand;
+        hand = (hand + 1) % cacheSize;
+    }
+    return victim;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Touch
+// 	Record that a cache entry has just been used, for whichever
+//	replacement policy is in effect.
+//----------------------------------------------------------------------
+
+void SynchDisk::Touch(CacheEntry *entry)
+{
+    entry->referenced = TRUE;
+    entry->lastUsed = ++useCount;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
 // 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+//	request to finish.  If it was a read-ahead, the sector is in the
+//	cache now; wake up the thread waiting to use the disk, if there is
+//	one, otherwise go on with the next read-ahead.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack()
 {
-    semaphore->V();
+    if (readAheadSector == -1)
+    {
+        semaphore->V(); // a read or write
+        return;
+    }
+
+    readAheadSector = -1;
+    if (diskOwned)
+        semaphore->V();
+    else
+        StartReadAhead();
 }
@@ -25,22 +25,71 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// Sectors are kept in a buffer cache in front of the raw disk, so that
+// the sectors the file system touches over and over (the bitmap and
+// directory headers in sectors 0 and 1, the directory itself) are only
+// read once.  The cache is write-back: WriteSector only updates the
+// cached copy and marks it dirty, and the sector goes to disk when it
+// is evicted or when FlushCache is called (the file system does this
+// when it shuts down).
+//
+// ReadAhead queues sectors to be read into the cache in the background,
+// one request after the other, driven by the disk interrupt; a read or
+// write waits for the read-ahead request in flight (if any) to finish,
+// and the queue resumes once the disk is free again.
+
+// Default number of sectors held by the buffer cache
+const int DefaultCacheSectors = 64;
+
+// Most sectors waiting to be read ahead; more are dropped
+const int ReadAheadQueueSize = SectorsPerTrack;
+
+// How the buffer cache picks the sector to evict
+enum CachePolicy {
+    CacheClock, // second chance: skip sectors used since the hand last passed
+    CacheLRU    // the sector used least recently
+};
+
+// One sector held by the buffer cache
+class CacheEntry
+{
+public:
+    int sector;            // the cached sector, -1 if the entry is free
+    bool dirty;            // modified since it was read from disk?
+    bool referenced;       // used since the CLOCK hand last passed?
+    int lastUsed;          // when it was last used, for LRU
+    char data[SectorSize]; // the contents of the sector
+};
 
 class SynchDisk : public CallBackObj
 {
 public:
-    SynchDisk();  // Initialize a synchronous disk,
-                  // by initializing the raw Disk.
-    ~SynchDisk(); // De-allocate the synch disk data
+    SynchDisk(int cacheSectors = DefaultCacheSectors,
+              CachePolicy policy = CacheClock);
+    // Initialize a synchronous disk,
+    // by initializing the raw Disk.
+    // A cache of 0 sectors sends every
+    // request straight to the disk.
+    ~SynchDisk(); // De-allocate the synch disk data,
+                  // flushing the cache first
 
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
     // only once the data is actually read
-    // or written.  These call
+    // or written.  These go through the
+    // buffer cache; on a miss they call
     // Disk::ReadRequest/WriteRequest and
     // then wait until the request is done.
     void WriteSector(int sectorNumber, char *data);
 
+    void FlushCache(); // Write every dirty sector back to disk
+
+    void ReadAhead(int *sectors, int count);
+    // Queue sectors to be read into the
+    // cache in the background, returning
+    // at once
+
     void CallBack(); // Called by the disk device interrupt
                      // handler, to signal that the
                      // current disk operation is complete.
@@ -51,6 +100,42 @@ private:
                           // with the interrupt handler
     Lock *lock;           // Only one read/write request
                           // can be sent to the disk at a time
+
+    CacheEntry *cache;    // the buffer cache
+    int cacheSize;        // number of entries in the cache
+    CachePolicy policy;   // how a victim is chosen
+    int *cached;          // the entry holding each sector, -1 if none
+    int hand;             // next entry the CLOCK hand looks at
+    int useCount;         // incremented on every access, for LRU
+
+    int readAheadQueue[ReadAheadQueueSize];
+    // sectors waiting to be read ahead,
+    // a circular buffer
+    int readAheadFirst;   // the oldest sector in the queue
+    int readAheadCount;   // how many sectors are queued
+    int readAheadSector;  // the sector being read ahead, -1 if none
+    bool diskOwned;       // is a read or write using the disk?
+                          // no read-ahead is started until it is done
+
+    void AcquireDisk(); // Wait for the read-ahead in flight,
+                        // and stop starting new ones
+    void ReleaseDisk(); // Let read-ahead resume
+    void StartReadAhead(); // Send the next queued read-ahead
+                           // to the disk, interrupts off
+
+    void DiskRead(int sectorNumber, char *data);
+    // Read/write the disk itself, the
+    // lock must be held
+    void DiskWrite(int sectorNumber, char *data);
+
+    CacheEntry *Lookup(int sectorNumber);
+    // The entry holding the sector (marked
+    // used), NULL on a miss
+    CacheEntry *Allocate(int sectorNumber);
+    // Evict an entry (writing it back if
+    // it is dirty) and give it to the sector
+    int Victim(); // The entry the policy evicts next
+    void Touch(CacheEntry *entry); // Mark an entry as just used
 };
 
 #endif // SYNCHDISK_H
@@ -31,10 +31,17 @@ Bitmap::Bitmap(int numItems)
     {
         map[i] = 0; // initialize map to keep Purify happy
     }
-    for (i = 0; i < numBits; i++)
+
+    // one summary level on top of the other, until one word covers it all
+    level[0] = map;
+    levelWords[0] = numWords;
+    for (numLevels = 1; levelWords[numLevels - 1] > 1; numLevels++)
     {
-        Clear(i);
+        ASSERT(numLevels < MaxBitmapLevels);
+        levelWords[numLevels] = divRoundUp(levelWords[numLevels - 1], BitsInWord);
+        level[numLevels] = new unsigned int[levelWords[numLevels]];
     }
+    Rebuild();
 }
 
 //----------------------------------------------------------------------
@@ -44,6 +51,10 @@ Bitmap::Bitmap(int numItems)
 
 Bitmap::~Bitmap()
 {
+    for (int k = 1; k < numLevels; k++)
+    {
+        delete[] level[k];
+    }
     delete[] map;
 }
 
@@ -58,7 +69,11 @@ void Bitmap::Mark(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (!Test(which))
+    {
+        SetBit(which);
+        numClear--;
+    }
 
     ASSERT(Test(which));
 }
@@ -74,7 +89,11 @@ void Bitmap::Clear(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (Test(which))
+    {
+        ClearBit(which);
+        numClear++;
+    }
 
     ASSERT(!Test(which));
 }
@@ -90,7 +109,7 @@ bool Bitmap::Test(int which) const
 {
     ASSERT(which >= 0 && which < numBits);
 
-    if (map[which / BitsInWord] & (1 << (which % BitsInWord)))
+    if (map[which / BitsInWord] & (1U << (which % BitsInWord)))
     {
         return TRUE;
     }
@@ -111,15 +130,13 @@ bool Bitmap::Test(int which) const
 
 int Bitmap::FindAndSet()
 {
-    for (int i = 0; i < numBits; i++)
+    int which = NextClear(0);
+
+    if (which != -1)
     {
-        if (!Test(i))
-        {
-            Mark(i);
-            return i;
-        }
+        Mark(which);
     }
-    return -1;
+    return which;
 }
 
 //----------------------------------------------------------------------
@@ -130,16 +147,162 @@ int Bitmap::FindAndSet()
 
 int Bitmap::NumClear() const
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++)
+//----------------------------------------------------------------------
+// Bitmap::NextClear
+// 	Return the number of the first clear bit at or after "from", or
+//	-1 if there is none.
+//
+//	Climb the summary levels until a word has a clear bit at or
+//	after the position we are looking from, then come back down
+//	through the first clear bit of each word below it.
+//----------------------------------------------------------------------
+
+int Bitmap::NextClear(int from) const
+{
+    int k, which = from;
+
+    ASSERT(from >= 0);
+    if (from >= numBits)
+    {
+        return -1;
+    }
+
+    for (k = 0; k < numLevels; k++)
+    {
+        int word = which / BitsInWord;
+        if (word >= levelWords[k])
+        {
+            return -1;
+        }
+        unsigned int clear = ~level[k][word] & (~0U << (which % BitsInWord));
+        if (clear != 0)
+        {
+            which = word * BitsInWord + __builtin_ctz(clear);
+            break;
+        }
+        which = word + 1; // the next word, as a bit of the level above
+    }
+    if (k == numLevels)
+    {
+        return -1;
+    }
+
+    for (; k > 0; k--)
+    {
+        which = which * BitsInWord + __builtin_ctz(~level[k - 1][which]);
+    }
+    return which;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NextSet
+// 	Return the number of the first set bit in [from, to), a word at a
+//	time, or "to" if there is none.
+//----------------------------------------------------------------------
+
+int Bitmap::NextSet(int from, int to) const
+{
+    ASSERT(from >= 0 && to <= numBits);
+
+    for (int which = from; which < to;)
+    {
+        int word = which / BitsInWord;
+        unsigned int set = map[word] & (~0U << (which % BitsInWord));
+        if (set != 0)
+        {
+            return min(word * BitsInWord + __builtin_ctz(set), to);
+        }
+        which = (word + 1) * BitsInWord;
+    }
+    return to;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::Rebuild
+// 	Recompute the count of clear bits and the summary levels from
+//	"map", after it has been overwritten as a whole (for instance,
+//	read in from disk).  The bits past "numBits" in the last word of
+//	each level are set, so that they are never found clear.
+//----------------------------------------------------------------------
+
+void Bitmap::Rebuild()
+{
+    int i, k;
+
+    if (numBits % BitsInWord != 0)
+    {
+        map[numWords - 1] |= ~0U << (numBits % BitsInWord);
+    }
+
+    numClear = 0;
+    for (i = 0; i < numWords; i++)
+    {
+        numClear += __builtin_popcount(~map[i]);
+    }
+
+    for (k = 1; k < numLevels; k++)
     {
-        if (!Test(i))
+        int below = levelWords[k - 1];
+        for (i = 0; i < levelWords[k]; i++)
         {
-            count++;
+            level[k][i] = 0;
+        }
+        if (below % BitsInWord != 0)
+        {
+            level[k][levelWords[k] - 1] = ~0U << (below % BitsInWord);
+        }
+        for (i = 0; i < below; i++)
+        {
+            if (level[k - 1][i] == ~0U)
+            {
+                level[k][i / BitsInWord] |= 1U << (i % BitsInWord);
+            }
         }
     }
-    return count;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::SetBit
+// 	Set a bit of "map".  If that fills its word, set the word's bit
+//	in the level above, and so on up.
+//----------------------------------------------------------------------
+
+void Bitmap::SetBit(int which)
+{
+    for (int k = 0; k < numLevels; k++)
+    {
+        unsigned int *word = &level[k][which / BitsInWord];
+        *word |= 1U << (which % BitsInWord);
+        if (*word != ~0U)
+        {
+            break; // the levels above do not change
+        }
+        which /= BitsInWord;
+    }
+}
+
+//----------------------------------------------------------------------
+// Bitmap::ClearBit
+// 	Clear a bit of "map".  If its word was full, clear the word's bit
+//	in the level above, and so on up.
+//----------------------------------------------------------------------
+
+void Bitmap::ClearBit(int which)
+{
+    for (int k = 0; k < numLevels; k++)
+    {
+        unsigned int *word = &level[k][which / BitsInWord];
+        bool wasFull = (*word == ~0U);
+        *word &= ~(1U << (which % BitsInWord));
+        if (!wasFull)
+        {
+            break; // the levels above do not change
+        }
+        which /= BitsInWord;
+    }
 }
 
 //----------------------------------------------------------------------
@@ -172,7 +335,7 @@ void Bitmap::SelfTest()
 {
     int i;
 
-    ASSERT(numBits >= BitsInWord); // bitmap must be big enough
+    ASSERT(numBits > BitsInWord + 1); // bitmap must be big enough
 
     ASSERT(NumClear() == numBits); // bitmap must be empty
     ASSERT(FindAndSet() == 0);
@@ -189,8 +352,23 @@ void Bitmap::SelfTest()
         Mark(i);
     }
     ASSERT(FindAndSet() == -1); // bitmap should be full!
+    ASSERT(NumClear() == 0);
+
+    // searches across words, and through the summary levels
+    Clear(numBits - 1);
+    Clear(BitsInWord);
+    ASSERT(NumClear() == 2);
+    ASSERT(NextClear(0) == BitsInWord);
+    ASSERT(NextClear(BitsInWord + 1) == numBits - 1);
+    ASSERT(NextSet(BitsInWord, numBits) == BitsInWord + 1);
+    ASSERT(FindAndSet() == BitsInWord);
+    ASSERT(FindAndSet() == numBits - 1);
+    ASSERT(NextClear(0) == -1);
+
     for (i = 0; i < numBits; i++)
     {
         Clear(i);
     }
+    ASSERT(NumClear() == numBits);
+    ASSERT(NextSet(0, numBits) == numBits);
 }
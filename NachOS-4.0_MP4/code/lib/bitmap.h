@@ -4,6 +4,11 @@
 //
 //	Represented as an array of unsigned integers, on which we do
 //	modulo arithmetic to find the bit we are interested in.
+//	Searches and counts work a word at a time (with the compiler's
+//	count-trailing-zeros and population-count builtins), the number
+//	of clear bits is kept up to date as bits change, and a hierarchy
+//	of summary bitmaps (one bit per word below it, set when that word
+//	is full) finds a clear bit in one word per level.
 //
 //	The bitmap can be parameterized with with the number of bits being
 //	managed.
@@ -22,6 +27,10 @@
 const int BitsInByte = 8;
 const int BitsInWord = sizeof(unsigned int) * BitsInByte;
 
+// Most levels of the bitmap, the bits themselves included; enough for
+// any number of bits an int can count
+const int MaxBitmapLevels = 7;
+
 // The following class defines a "bitmap" -- an array of bits,
 // each of which can be independently set, cleared, and tested.
 //
@@ -45,6 +54,12 @@ public:
         // If no bits are clear, return -1.
     int NumClear() const; // Return the number of clear bits
 
+    int NextClear(int from) const;   // Return the # of the first clear bit
+                                     // at or after "from", -1 if none
+    int NextSet(int from, int to) const;
+    // Return the # of the first set bit
+    // in [from, to), "to" if none
+
     void Print() const; // Print contents of bitmap
     void SelfTest();    // Test whether bitmap is working
 
@@ -55,6 +70,24 @@ protected:
                        //  multiple of the number of bits in
                        //  a word)
     unsigned int *map; // bit storage
+
+    void Rebuild(); // Recompute the summaries and the
+                    // count, after "map" has been
+                    // overwritten as a whole
+
+private:
+    int numClear;   // number of clear bits
+    int numLevels;  // levels in use, "map" being level 0
+    unsigned int *level[MaxBitmapLevels];
+    // level k has a bit for each word of
+    // level k - 1, set if the word is full
+    int levelWords[MaxBitmapLevels]; // words in each level
+
+    void SetBit(int which);   // Set a bit of "map", and the
+                              // summary bits of any word filled
+    void ClearBit(int which); // Clear a bit of "map", and the
+                              // summary bits of any word no
+                              // longer full
 };
 
 #endif // BITMAP_H
@@ -253,8 +253,7 @@ void Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
-    delete debug;
-
+    // the kernel deletes "debug" itself, after its last disk I/O
     delete kernel; // Never returns.
 }
 
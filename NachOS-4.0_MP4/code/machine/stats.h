@@ -30,6 +30,10 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numDiskCacheHits;	// number of sector requests served by
+				// the buffer cache (cf. synchdisk.h)
+    int numDiskCacheMisses;	// number of sector requests that missed it
+    int numDiskReadAheads;	// number of sectors read ahead into it
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
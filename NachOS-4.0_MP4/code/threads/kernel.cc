@@ -33,6 +33,8 @@ Kernel::Kernel(int argc, char **argv)
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
 #endif
+    diskCacheSectors = DefaultCacheSectors;
+    diskCacheLRU = FALSE;       // CLOCK replacement by default
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
@@ -64,6 +66,16 @@ Kernel::Kernel(int argc, char **argv)
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
 #endif
+		} else if (strcmp(argv[i], "-dc") == 0) {
+	    	ASSERT(i + 1 < argc);   // next argument is int
+	    	diskCacheSectors = atoi(argv[i + 1]);
+	    	ASSERT(diskCacheSectors >= 0);
+	    	i++;
+		} else if (strcmp(argv[i], "-dcp") == 0) {
+	    	ASSERT(i + 1 < argc);   // next argument is "lru" or "clock"
+	    	ASSERT(strcmp(argv[i + 1], "lru") == 0 || strcmp(argv[i + 1], "clock") == 0);
+	    	diskCacheLRU = (strcmp(argv[i + 1], "lru") == 0);
+	    	i++;
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
             reliability = atof(argv[i + 1]);
@@ -79,6 +91,7 @@ Kernel::Kernel(int argc, char **argv)
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
 #endif
+            cout << "Partial usage: nachos [-dc #] [-dcp lru|clock]\n";
             cout << "Partial usage: nachos [-n #] [-m #]\n";
 		}
     }
@@ -109,7 +122,8 @@ Kernel::Initialize()
     machine = new Machine(debugUserProg);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    synchDisk = new SynchDisk(diskCacheSectors,
+                              diskCacheLRU ? CacheLRU : CacheClock);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
@@ -146,6 +160,10 @@ Kernel::PrepareToEnd()
 
 Kernel::~Kernel()
 {
+    // the file system flushes the disk cache as it shuts down, which
+    // needs the disk, the interrupts and the scheduler to still work
+    delete fileSystem;
+    delete synchDisk;
     delete stats;
     delete interrupt;
     delete scheduler;
@@ -153,8 +171,6 @@ Kernel::~Kernel()
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
-    delete fileSystem;
 	
 	// Mp4 mod tag
 	/*
@@ -162,6 +178,7 @@ Kernel::~Kernel()
     delete postOfficeOut;
     */
 	
+    delete debug;
     Exit(0);
 }
 
@@ -84,6 +84,8 @@ class Kernel {
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
 #endif
+    int diskCacheSectors;       // size of the disk buffer cache
+    bool diskCacheLRU;          // evict LRU instead of CLOCK
 };
 
 